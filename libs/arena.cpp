@@ -0,0 +1,69 @@
+/*
+** Linear memory arena
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include "arena.hpp"
+
+// Constructor: Uses the buffer as the arena memory
+Arena::Arena(void *buffer, size_t size) : buffer((uint8_t *)buffer), size(size), offset(0), peak_offset(0), overflow_count(0) {
+    // Skip the unaligned head of the buffer
+    size_t head = (ARENA_ALIGNMENT - ((uintptr_t)buffer % ARENA_ALIGNMENT)) % ARENA_ALIGNMENT;
+    this->buffer += head;
+    this->size = (size > head) ? (size - head) : 0;
+}
+
+// Returns an aligned buffer, or NULL if the arena is exhausted
+void* Arena::alloc(size_t size) {
+    size = ARENA_ALIGN(size);
+    if (size > this->size - offset) {
+        overflow_count++;
+        return NULL;
+    }
+
+    void *p = buffer + offset;
+    offset += size;
+    if (offset > peak_offset) peak_offset = offset;
+    return p;
+}
+
+// Returns a matrix backed by the arena.
+// Falls back to the heap (and counts an overflow) if the arena is too small.
+cv::Mat Arena::mat(int rows, int cols, int type) {
+    void *p = alloc((size_t)rows * cols * CV_ELEM_SIZE(type));
+    if (p == NULL) return cv::Mat(rows, cols, type);
+    return cv::Mat(rows, cols, type, p);
+}
+
+// Releases all buffers
+void Arena::reset() {
+    offset = 0;
+}
+
+// Restarts the peak and the overflow count
+void Arena::clear_stats() {
+    peak_offset = offset;
+    overflow_count = 0;
+}
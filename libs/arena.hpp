@@ -0,0 +1,63 @@
+/*
+** Linear memory arena
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include "opencv.hpp"
+
+// Alignment of every allocation (matches the frame buffer burst alignment)
+#define ARENA_ALIGNMENT 32
+
+// Rounds up a buffer size to the arena alignment
+#define ARENA_ALIGN(size) (((size) + (ARENA_ALIGNMENT - 1)) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+// Bump allocator over a fixed buffer.
+// Buffers are never freed individually; reset() releases everything at once.
+class Arena {
+public:
+    Arena(void *buffer, size_t size);
+
+    void* alloc(size_t size);
+    cv::Mat mat(int rows, int cols, int type);
+    void reset();
+    void clear_stats();
+
+    size_t used() const { return offset; }
+    size_t peak() const { return peak_offset; }
+    size_t capacity() const { return size; }
+    unsigned int overflows() const { return overflow_count; }
+private:
+    uint8_t *buffer;
+    size_t size;
+    size_t offset;
+    size_t peak_offset;
+    unsigned int overflow_count;
+};
+
+#endif
@@ -29,6 +29,8 @@
 */
 
 #include "camera_if.hpp"
+#include "reconstruction.hpp"
+#include "trace.hpp"
 #include "JPEG_Converter.h"
 #include "dcache-control.h"
 
@@ -37,6 +39,26 @@ using namespace cv;
 static uint8_t FrameBuffer_Video[FRAME_BUFFER_STRIDE * FRAME_BUFFER_HEIGHT]__attribute((section("NC_BSS"),aligned(32)));
 static uint8_t JpegBuffer[1024 * 63]__attribute((aligned(32)));
 
+/* Half resolution copy of the video frame (taken from an arena) */
+#define HALF_PIXEL_HW          (VIDEO_PIXEL_HW / 2)
+#define HALF_PIXEL_VW          (VIDEO_PIXEL_VW / 2)
+
+/* Frame timing (end of each frame written into FrameBuffer_Video) */
+#define CAPTURE_DIFF_COLUMNS   ((int)(VIDEO_PIXEL_HW + CAPTURE_DIFF_STEP - 1) / CAPTURE_DIFF_STEP)
+#define CAPTURE_DIFF_ROWS      ((int)(VIDEO_PIXEL_VW + CAPTURE_DIFF_STEP - 1) / CAPTURE_DIFF_STEP)
+static volatile uint32_t field_count = 0;
+static volatile uint32_t field_time = 0;       // us_ticker time of the last frame end
+static volatile uint32_t field_prev_time = 0;  // and of the one before
+static uint32_t motion_end_time = 0;
+static bool motion_pending = false;            // the turntable moved since the last still frame
+static Semaphore field_signal(0);              // released at the frame end a thread waits for
+static volatile bool field_waiting = false;
+static uint8_t frame_samples[2][CAPTURE_DIFF_COLUMNS * CAPTURE_DIFF_ROWS];
+
+/* Frame read by the image functions: the live frame, or the copy kept by camera_hold_frame() */
+static uint8_t *frame_copy = NULL;
+static uint8_t *frame_source = FrameBuffer_Video;
+
 /* jpeg convert */
 static JPEG_Converter Jcu;
 static DisplayBase Display;
@@ -94,6 +116,7 @@ void DrawSquare(int x, int y, int w, int h, uint32_t const colour) {
 #endif
 
 size_t encode_jpeg(uint8_t* buf, int len, int width, int height, uint8_t* inbuf) {
+    TRACE_SCOPE("jpeg_encode");
     size_t encode_size;
     JPEG_Converter::bitmap_buff_info_t bitmap_buff_info;
     JPEG_Converter::encode_options_t encode_options;
@@ -116,16 +139,150 @@ size_t encode_jpeg(uint8_t* buf, int len, int width, int height, uint8_t* inbuf)
 }
 
 size_t create_jpeg(){
+    if (frame_source != FrameBuffer_Video) {
+        return create_jpeg_yuv(frame_source, VIDEO_PIXEL_HW, VIDEO_PIXEL_VW);
+    }
     return encode_jpeg(JpegBuffer, sizeof(JpegBuffer), VIDEO_PIXEL_HW, VIDEO_PIXEL_VW, FrameBuffer_Video);
 }
 
+size_t create_jpeg_half(Arena &arena){
+    uint8_t *half = (uint8_t *)arena.alloc(HALF_PIXEL_HW * HALF_PIXEL_VW * DATA_SIZE_PER_PIC);
+    if (half == NULL) return 0;
+
+    // YUY2 words (Y0 U Y1 V, little endian): keep the chroma and first luma of every
+    // other word and the first luma of the next one, on every other row
+    for (int y = 0; y < (int)HALF_PIXEL_VW; y++) {
+        const uint32_t *in = (const uint32_t *)(frame_source + 2 * y * FRAME_BUFFER_STRIDE);
+        uint32_t *out = (uint32_t *)(half + y * HALF_PIXEL_HW * DATA_SIZE_PER_PIC);
+        for (int x = 0; x < (int)HALF_PIXEL_HW / 2; x++, in += 2) {
+            out[x] = (in[0] & 0xff00ffff) | ((in[1] & 0xff) << 16);
+        }
+    }
+    return create_jpeg_yuv(half, HALF_PIXEL_HW, HALF_PIXEL_VW);
+}
+
+size_t create_jpeg_yuv(uint8_t* yuv, int width, int height){
+    // The encoder reads memory directly, so write back what is still in the cache
+    dcache_clean(yuv, width * height * DATA_SIZE_PER_PIC);
+    return encode_jpeg(JpegBuffer, sizeof(JpegBuffer), width, height, yuv);
+}
+
 uint8_t* get_jpeg_adr(){
     return JpegBuffer;
 }
 
+const uint8_t* get_frame_adr(){
+    return frame_source;
+}
+
+static void field_end(DisplayBase::int_type_t int_type) {
+    (void)int_type;
+    field_prev_time = field_time;
+    field_time = us_ticker_read();
+    field_count++;
+    if (field_waiting) {
+        field_waiting = false;
+        field_signal.release();
+    }
+}
+
+/* Waits for the end of the next frame (returns false if the camera does not signal it) */
+static bool wait_field(void) {
+    // Drop a frame end that came just after the last timeout
+    field_signal.wait(0);
+    field_waiting = true;
+    if (field_signal.wait(CAPTURE_FIELD_TIMEOUT) > 0) return true;
+    field_waiting = false;
+    return false;
+}
+
+/* Keeps a grid of luma samples of the frame buffer */
+static void sample_frame(uint8_t *samples) {
+    for (int r = 0; r < CAPTURE_DIFF_ROWS; r++) {
+        const uint8_t *row = FrameBuffer_Video + r * CAPTURE_DIFF_STEP * FRAME_BUFFER_STRIDE;
+        for (int c = 0; c < CAPTURE_DIFF_COLUMNS; c++) {
+            // YUY2: the luma of pixel x is byte 2x
+            *samples++ = row[c * CAPTURE_DIFF_STEP * 2];
+        }
+    }
+}
+
+/* Compares two grids of luma samples */
+static bool frame_moved(const uint8_t *a, const uint8_t *b) {
+    int count = 0;
+    for (int i = 0; i < CAPTURE_DIFF_COLUMNS * CAPTURE_DIFF_ROWS; i++) {
+        if (abs(a[i] - b[i]) > CAPTURE_DIFF_LEVEL && ++count >= CAPTURE_DIFF_SAMPLES) return true;
+    }
+    return false;
+}
+
+void camera_motion_end(void) {
+    motion_end_time = us_ticker_read();
+    motion_pending = true;
+}
+
+/* Waits for a still frame */
+int camera_wait_still(int settle_ms, int max_frames) {
+    TRACE_SCOPE("wait_still");
+    // The frame after the first frame end past the settle time is exposed on a still table.
+    // Without a motion since the last still frame the table has settled already. Frames
+    // are more than 1 ms apart, so settle_ms + 1 frame ends always pass the settle time.
+    if (motion_pending) {
+        motion_pending = false;
+        uint32_t settle_end = motion_end_time + settle_ms * 1000;
+        for (int i = 0; i <= settle_ms && ((int32_t)(field_time - settle_end) < 0 || field_count == 0); i++) {
+            if (!wait_field()) return -1;
+        }
+    }
+
+    // The frame that was being written at the settle time is the reference, so a
+    // table that settled in time costs one frame. Otherwise wait until two
+    // consecutive frames match.
+    int current = 0;
+    sample_frame(frame_samples[current]);
+    int frames;
+    for (frames = 0; frames < max_frames; frames++) {
+        if (!wait_field()) return -1;
+        current ^= 1;
+        sample_frame(frame_samples[current]);
+        if (!frame_moved(frame_samples[0], frame_samples[1])) break;
+    }
+    return frames;
+}
+
+/* Waits for the next frame */
+uint32_t camera_wait_frame(void) {
+    if (!wait_field()) return us_ticker_read();
+    uint32_t begin = field_prev_time, end = field_time;
+    return begin + (end - begin) / 2;
+}
+
+/* Keeps a copy of the frame */
+void camera_hold_frame(void) {
+    TRACE_SCOPE("hold_frame");
+    if (frame_copy == NULL) {
+        // Only continuous rotation needs it (the JPEG encoder reads 32 byte aligned memory)
+        uint8_t *buffer = new uint8_t[FRAME_BUFFER_STRIDE * FRAME_BUFFER_HEIGHT + 32];
+        frame_copy = (uint8_t *)(((uintptr_t)buffer + 31) & ~(uintptr_t)31);
+    }
+    // Copying from the top stays ahead of the next frame being written
+    memcpy(frame_copy, FrameBuffer_Video, FRAME_BUFFER_STRIDE * FRAME_BUFFER_HEIGHT);
+    frame_source = frame_copy;
+}
+
+void camera_release_frame(void) {
+    frame_source = FrameBuffer_Video;
+}
+
 /* Starts the camera */
 void camera_start(void)
 {
+    MEMPROF_STATIC("FrameBuffer_Video", sizeof(FrameBuffer_Video));
+    MEMPROF_STATIC("JpegBuffer", sizeof(JpegBuffer));
+#if MBED_CONF_APP_LCD
+    MEMPROF_STATIC("LCD layer 2", sizeof(user_frame_buffer_result));
+#endif
+
     // Initialize the background to black
     for (int i = 0; i < sizeof(FrameBuffer_Video); i += 2) {
         FrameBuffer_Video[i + 0] = 0x10;
@@ -150,6 +307,8 @@ void camera_start(void)
         VIDEO_PIXEL_VW,
         VIDEO_PIXEL_HW
     );
+    // Frame end interrupt for camera_wait_still()
+    Display.Graphics_Irq_Handler_Set(DisplayBase::INT_TYPE_S0_VFIELD, 0, field_end);
     EasyAttach_CameraStart(Display, DisplayBase::VIDEO_INPUT_CHANNEL_0);
 
 #if MBED_CONF_APP_LCD
@@ -193,10 +352,12 @@ void camera_start(void)
 }
 
 /* Takes a video frame */
-void create_gray(Mat &img_gray)
+void create_gray(Mat &img_gray, Arena &arena)
 {
     // Transform buffer into OpenCV matrix
-    Mat img_yuv(VIDEO_PIXEL_VW, VIDEO_PIXEL_HW, CV_8UC2, FrameBuffer_Video);
+    Mat img_yuv(VIDEO_PIXEL_VW, VIDEO_PIXEL_HW, CV_8UC2, frame_source);
+
+    img_gray = arena.mat(VIDEO_PIXEL_VW, VIDEO_PIXEL_HW, CV_8U);
 
     // Convert from YUV422 to grayscale
     // [Note] Although the camera spec says the color space is YUV422,
@@ -207,32 +368,36 @@ void create_gray(Mat &img_gray)
 }
 
 /* Takes a silhouette */
-cv::Mat get_silhouette() {
-    Mat img_silhouette(VIDEO_PIXEL_VW, VIDEO_PIXEL_HW, CV_8U);
+cv::Mat get_silhouette(Arena &arena, const Rect &roi) {
+    TRACE_SCOPE("get_silhouette");
+    Mat img_silhouette = arena.mat(roi.height, roi.width, CV_8U);
 
     // Transform buffer into OpenCV matrix
-    Mat img_yuv(VIDEO_PIXEL_VW, VIDEO_PIXEL_HW, CV_8UC2, FrameBuffer_Video);
-
-    // To reduce memory usage, process each row
-    for (int y=0; y<VIDEO_PIXEL_VW; y++) {
+    Mat img_yuv(VIDEO_PIXEL_VW, VIDEO_PIXEL_HW, CV_8UC2, frame_source);
+
+    // YUY2 stores U and V for pixel pairs, so convert from an even column
+    int u0 = roi.x & ~1;
+    int width = ((roi.x + roi.width + 1) & ~1) - u0;
+    if (u0 + width > (int)VIDEO_PIXEL_HW) width = VIDEO_PIXEL_HW - u0;
+
+    // To reduce memory usage, process each row.
+    // The row buffers are allocated once so OpenCV converts into them without reallocating.
+    Mat img_rgb = arena.mat(1, width, CV_8UC3);
+    Mat img_hsv = arena.mat(1, width, CV_8UC3);
+    for (int y=0; y<roi.height; y++) {
         // Define region of interesting
-        Rect roi(0, y, VIDEO_PIXEL_HW, 1);
-        Mat img_roi = img_yuv(roi);
-        Mat img_silhouette_roi = img_silhouette(roi);
+        Mat img_roi = img_yuv(Rect(u0, roi.y + y, width, 1));
+        Mat img_silhouette_roi = img_silhouette(Rect(0, y, roi.width, 1));
 
         // Convert color from YUV to HSV
-        Mat img_rgb;
         cvtColor(img_roi, img_rgb, COLOR_YUV2RGB_YUY2);
-        Mat img_hsv;
         cvtColor(img_rgb, img_hsv, COLOR_RGB2HSV);
 
         // Detect blue color
-        Mat mask;
-        inRange(img_hsv, Scalar(100, 50, 0), Scalar(140, 255, 255), mask);
+        inRange(img_hsv(Rect(roi.x - u0, 0, roi.width, 1)), BACKGROUND_HSV_LOWER, BACKGROUND_HSV_UPPER, img_silhouette_roi);
 
         // Make a silhouette from blue mask
-        bitwise_not(mask, mask);
-        mask.copyTo(img_silhouette_roi);
+        bitwise_not(img_silhouette_roi, img_silhouette_roi);
     }
 
     return img_silhouette;
@@ -240,25 +405,9 @@ cv::Mat get_silhouette() {
 
 /* Save jpeg to storage */
 void save_image_jpg(const char* file_name) {
-    size_t jcu_encode_size;
-    JPEG_Converter::bitmap_buff_info_t bitmap_buff_info;
-    JPEG_Converter::encode_options_t   encode_options;
-
-    bitmap_buff_info.width              = VIDEO_PIXEL_HW;
-    bitmap_buff_info.height             = VIDEO_PIXEL_VW;
-    bitmap_buff_info.format             = JPEG_Converter::WR_RD_YCbCr422;
-    bitmap_buff_info.buffer_address     = (void *)FrameBuffer_Video;
-
-    encode_options.encode_buff_size     = sizeof(JpegBuffer);
-    encode_options.p_EncodeCallBackFunc = NULL;
-    encode_options.input_swapsetting    = JPEG_Converter::WR_RD_WRSWA_32_16_8BIT;
-
-    jcu_encode_size = 0;
-    dcache_invalid(JpegBuffer, sizeof(JpegBuffer));
-    if (Jcu.encode(&bitmap_buff_info, JpegBuffer, &jcu_encode_size, &encode_options) != JPEG_Converter::JPEG_CONV_OK) {
-        jcu_encode_size = 0;
-    }
+    size_t jcu_encode_size = create_jpeg();
 
+    TRACE_SCOPE("sd_write");
     FILE * fp = fopen(file_name, "w");
     fwrite(JpegBuffer, sizeof(char), (int)jcu_encode_size, fp);
     fclose(fp);
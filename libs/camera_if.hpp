@@ -35,6 +35,7 @@
 #include "DisplayBace.h"
 #include "opencv.hpp"
 #include "EasyAttach_CameraAndLCD.h"
+#include "arena.hpp"
 
 /* Video input and LCD layer 0 output */
 #define VIDEO_FORMAT           (DisplayBase::VIDEO_FORMAT_YCBCR422)
@@ -58,6 +59,15 @@
 #define FRAME_BUFFER_STRIDE    (((VIDEO_PIXEL_HW * DATA_SIZE_PER_PIC) + 31u) & ~31u)
 #define FRAME_BUFFER_HEIGHT    (VIDEO_PIXEL_VW)
 
+/* Still frame test of camera_wait_still() */
+#define CAPTURE_DIFF_STEP      (16)    /* sampling step of the luma in both directions (pixels) */
+#define CAPTURE_DIFF_LEVEL     (12)    /* luma difference of a changed sample (above the sensor noise) */
+#define CAPTURE_DIFF_SAMPLES   (4)     /* changed samples that make a moving frame */
+#define CAPTURE_FIELD_TIMEOUT  (100)   /* longest wait for the end of a frame (ms) */
+
+/* Arena size needed by get_silhouette() (silhouette and two scratch rows of the whole image) */
+#define CAMERA_ARENA_SIZE      (ARENA_ALIGN(VIDEO_PIXEL_HW * VIDEO_PIXEL_VW) + 2 * ARENA_ALIGN(VIDEO_PIXEL_HW * 3) + ARENA_ALIGNMENT)
+
 
 /**
 * @brief	Starts the camera
@@ -66,6 +76,43 @@
 */
 void camera_start(void);
 
+/**
+* @brief	Marks the end of the turntable motion (call after the last step)
+* @param	None
+* @return	None
+*/
+void camera_motion_end(void);
+
+/**
+* @brief	Waits for the first still frame exposed after the motion end and the settle time
+* @param	settle_ms	time the turntable may still vibrate after the motion end
+* @param	max_frames	frames to wait at most for a frame that does not move
+* @return	number of frames waited after the settle time (max_frames: still moving,
+*		-1: the camera does not signal the frame ends)
+*/
+int camera_wait_still(int settle_ms, int max_frames);
+
+/**
+* @brief	Waits for the end of the next frame
+* @param	None
+* @return	time of the middle of the frame transfer (us_ticker_read() time)
+*/
+uint32_t camera_wait_frame(void);
+
+/**
+* @brief	Keeps a copy of the frame that has just ended (read until camera_release_frame())
+* @param	None
+* @return	None
+*/
+void camera_hold_frame(void);
+
+/**
+* @brief	Reads the live frame again
+* @param	None
+* @return	None
+*/
+void camera_release_frame(void);
+
 /**
 * @brief	Create jpeg from yuv image
 * @param	None
@@ -73,6 +120,22 @@ void camera_start(void);
 */
 size_t create_jpeg();
 
+/**
+* @brief	Create jpeg from yuv image at half resolution (for previews during scans)
+* @param	arena	Arena to allocate the half resolution frame from
+* @return	jpeg size (0 if the arena is too small)
+*/
+size_t create_jpeg_half(Arena &arena);
+
+/**
+* @brief	Create jpeg from a yuv image in memory
+* @param	yuv	YCbCr422 image (cached memory is cleaned before encoding)
+* @param	width	image width (multiple of 16)
+* @param	height	image height (multiple of 8)
+* @return	jpeg size
+*/
+size_t create_jpeg_yuv(uint8_t* yuv, int width, int height);
+
 /**
 * @brief	Return jpeg addresse
 * @param	None
@@ -80,19 +143,29 @@ size_t create_jpeg();
 */
 uint8_t* get_jpeg_adr();
 
+/**
+* @brief	Return the address of the frame read by create_jpeg() and the image functions
+*		(the live frame, or the copy kept by camera_hold_frame())
+* @param	None
+* @return	video frame address (YCbCr422, FRAME_BUFFER_STRIDE bytes per row)
+*/
+const uint8_t* get_frame_adr();
+
 /**
 * @brief	Takes a video frame (in grayscale)
 * @param	img_gray	Grayscale video frame
+* @param	arena	Arena to allocate the frame from
 * @return	None
 */
-void create_gray(cv::Mat &img_gray);
+void create_gray(cv::Mat &img_gray, Arena &arena);
 
 /**
-* @brief	Takes a silhouette
-* @param	None
-* @return	Silhouette image
+* @brief	Takes a silhouette of a region of the camera image
+* @param	arena	Arena to allocate the silhouette and scratch buffers from
+* @param	roi	Region to convert (pixels outside it are background)
+* @return	Silhouette of the region, roi.width x roi.height (valid until the arena is reset)
 */
-cv::Mat get_silhouette();
+cv::Mat get_silhouette(Arena &arena, const cv::Rect &roi);
 
 /**
 * @brief	Save jpeg to storage
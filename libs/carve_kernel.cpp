@@ -0,0 +1,148 @@
+/*
+** Vectorized carving kernel
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <math.h>
+#include "carve_kernel.hpp"
+
+#if CARVE_SIMD == CARVE_SIMD_SSE
+#include <emmintrin.h>
+#elif CARVE_SIMD == CARVE_SIMD_AVX
+#include <immintrin.h>
+#elif CARVE_SIMD == CARVE_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+using namespace cv;
+
+// Prepares the kernel of the view taken at the turntable angle rad
+void carve_kernel_init(CarveKernel &kernel, const CameraModel &camera, double rad) {
+    kernel.c = (float)cos(rad);
+    kernel.s = (float)sin(rad);
+    kernel.distance = (float)camera.distance;
+    kernel.offset = (float)camera.offset;
+    kernel.fx = (float)camera.fx;
+    kernel.fy = (float)camera.fy;
+    kernel.center_u = (int)camera.center_u;
+    kernel.center_v = (int)camera.center_v;
+    kernel.width = camera.width;
+    kernel.height = camera.height;
+}
+
+// Vector part: truncated (Xc/Yc)*fx and (Zc/Yc)*fy of the voxels [0, count)
+static void project_run(const CarveKernel &kernel, const float *xs, int count, float yw, float zw, int32_t *tu, int32_t *tv) {
+    // Terms that are the same along the run
+    float sy = kernel.s * yw;
+    float cy = kernel.c * yw;
+    float zc = zw + kernel.offset;
+    float ns = -kernel.s;
+
+#if CARVE_SIMD == CARVE_SIMD_SSE
+    const __m128 c = _mm_set1_ps(kernel.c), s = _mm_set1_ps(ns);
+    const __m128 vsy = _mm_set1_ps(sy), vcy = _mm_set1_ps(cy), vzc = _mm_set1_ps(zc);
+    const __m128 distance = _mm_set1_ps(kernel.distance);
+    const __m128 fx = _mm_set1_ps(kernel.fx), fy = _mm_set1_ps(kernel.fy);
+    for (int i = 0; i < count; i += 4) {
+        __m128 x = _mm_loadu_ps(xs + i);
+        __m128 xc = _mm_add_ps(_mm_mul_ps(c, x), vsy);
+        __m128 yc = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(s, x), vcy), distance);
+        _mm_storeu_si128((__m128i *)(tu + i), _mm_cvttps_epi32(_mm_mul_ps(_mm_div_ps(xc, yc), fx)));
+        _mm_storeu_si128((__m128i *)(tv + i), _mm_cvttps_epi32(_mm_mul_ps(_mm_div_ps(vzc, yc), fy)));
+    }
+#elif CARVE_SIMD == CARVE_SIMD_AVX
+    const __m256 c = _mm256_set1_ps(kernel.c), s = _mm256_set1_ps(ns);
+    const __m256 vsy = _mm256_set1_ps(sy), vcy = _mm256_set1_ps(cy), vzc = _mm256_set1_ps(zc);
+    const __m256 distance = _mm256_set1_ps(kernel.distance);
+    const __m256 fx = _mm256_set1_ps(kernel.fx), fy = _mm256_set1_ps(kernel.fy);
+    for (int i = 0; i < count; i += 8) {
+        __m256 x = _mm256_loadu_ps(xs + i);
+        __m256 xc = _mm256_add_ps(_mm256_mul_ps(c, x), vsy);
+        __m256 yc = _mm256_sub_ps(_mm256_add_ps(_mm256_mul_ps(s, x), vcy), distance);
+        _mm256_storeu_si256((__m256i *)(tu + i), _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_div_ps(xc, yc), fx)));
+        _mm256_storeu_si256((__m256i *)(tv + i), _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_div_ps(vzc, yc), fy)));
+    }
+#elif CARVE_SIMD == CARVE_SIMD_NEON
+    // No vector division: 1/Yc from the reciprocal estimate and two Newton steps
+    // (within an ulp or two of the division, so a voxel within rounding error of a
+    // pixel border may land on the other side)
+    const float32x4_t c = vdupq_n_f32(kernel.c), s = vdupq_n_f32(ns);
+    const float32x4_t vsy = vdupq_n_f32(sy), vcy = vdupq_n_f32(cy), vzc = vdupq_n_f32(zc);
+    const float32x4_t distance = vdupq_n_f32(kernel.distance);
+    const float32x4_t fx = vdupq_n_f32(kernel.fx), fy = vdupq_n_f32(kernel.fy);
+    for (int i = 0; i < count; i += 4) {
+        float32x4_t x = vld1q_f32(xs + i);
+        float32x4_t xc = vaddq_f32(vmulq_f32(c, x), vsy);
+        float32x4_t yc = vsubq_f32(vaddq_f32(vmulq_f32(s, x), vcy), distance);
+        float32x4_t r = vrecpeq_f32(yc);
+        r = vmulq_f32(vrecpsq_f32(yc, r), r);
+        r = vmulq_f32(vrecpsq_f32(yc, r), r);
+        vst1q_s32(tu + i, vcvtq_s32_f32(vmulq_f32(vmulq_f32(xc, r), fx)));
+        vst1q_s32(tv + i, vcvtq_s32_f32(vmulq_f32(vmulq_f32(vzc, r), fy)));
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        float xc = kernel.c * xs[i] + sy;
+        float yc = ns * xs[i] + cy - kernel.distance;
+        tu[i] = (int32_t)((xc / yc) * kernel.fx);
+        tv[i] = (int32_t)((zc / yc) * kernel.fy);
+    }
+#endif
+}
+
+// Projects a run of voxels along X and returns the keep mask
+uint32_t carve_run(const CarveKernel &kernel, const Mat &img_silhouette,
+                   const float *xs, int count, float yw, float zw, uint32_t alive, uint32_t &in_image) {
+    int32_t tu[CARVE_RUN_MAX], tv[CARVE_RUN_MAX];
+    project_run(kernel, xs, count, yw, zw, tu, tv);
+
+    // Gather the silhouette pixels of the alive voxels
+    uint32_t keep = 0;
+    in_image = 0;
+    for (int i = 0; i < count; i++) {
+        if (!(alive & ((uint32_t)1 << i))) continue;
+
+        int u = kernel.center_u - tu[i];
+        int v = kernel.height - (kernel.center_v - tv[i]);
+        if (u>0 && u<kernel.width && v>0 && v<kernel.height) {
+            in_image |= (uint32_t)1 << i;
+            if (img_silhouette.ptr<unsigned char>(v)[u]) keep |= (uint32_t)1 << i;
+        }
+    }
+    return keep;
+}
+
+// Name of the selected instruction set
+const char* carve_simd_name() {
+#if CARVE_SIMD == CARVE_SIMD_SSE
+    return "SSE2";
+#elif CARVE_SIMD == CARVE_SIMD_AVX
+    return "AVX";
+#elif CARVE_SIMD == CARVE_SIMD_NEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,82 @@
+/*
+** Vectorized carving kernel
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef CARVE_KERNEL_HPP
+#define CARVE_KERNEL_HPP
+
+#include <stdint.h>
+#include "opencv.hpp"
+#include "geometry.hpp"
+#include "reconstruction.hpp"
+
+// Instruction sets of the kernel
+#define CARVE_SIMD_SCALAR   0   // Plain C++ (one voxel at a time)
+#define CARVE_SIMD_SSE      1   // SSE2, 4 voxels (x86 hosts)
+#define CARVE_SIMD_AVX      2   // AVX, 8 voxels (x86 hosts built with -mavx)
+#define CARVE_SIMD_NEON     3   // NEON, 4 voxels (Cortex-A9 boards)
+
+// Selected at compile time from the target (or -DCARVE_SIMD=n)
+#ifndef CARVE_SIMD
+#if defined(__AVX__)
+#define CARVE_SIMD CARVE_SIMD_AVX
+#elif defined(__SSE2__) || defined(_M_X64)
+#define CARVE_SIMD CARVE_SIMD_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define CARVE_SIMD CARVE_SIMD_NEON
+#else
+#define CARVE_SIMD CARVE_SIMD_SCALAR
+#endif
+#endif
+
+// The kernel computes in single precision, so shape_from_silhouette uses it when
+// GEOMETRY_SCALAR is float (GEOMETRY_VALIDATE keeps the per-voxel loop, which
+// compares every projection with double)
+#define CARVE_KERNEL_ENABLE ((GEOMETRY_SCALAR == GEOMETRY_FLOAT) && !GEOMETRY_VALIDATE)
+
+// Longest run of voxels handled by one carve_run call
+#define CARVE_RUN_MAX   32
+
+// Projection of one view in single precision (the same arithmetic as Projector<float>)
+typedef struct {
+    float c, s;
+    float distance, offset, fx, fy;
+    int center_u, center_v, width, height;
+} CarveKernel;
+
+// Prepares the kernel of the view taken at the turntable angle rad
+void carve_kernel_init(CarveKernel &kernel, const CameraModel &camera, double rad);
+
+// Projects the voxels (xs[i], yw, zw) of a run along X (count <= CARVE_RUN_MAX,
+// xs readable up to a multiple of 8) and returns the keep mask: bit i is set if voxel
+// i lands inside the silhouette. Only the voxels in alive are looked up, and the
+// bits of alive voxels inside the image are returned in in_image.
+uint32_t carve_run(const CarveKernel &kernel, const cv::Mat &img_silhouette,
+                   const float *xs, int count, float yw, float zw, uint32_t alive, uint32_t &in_image);
+
+// Name of the selected instruction set
+const char* carve_simd_name();
+
+#endif
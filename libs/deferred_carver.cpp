@@ -0,0 +1,167 @@
+/*
+** Deferred multi-view carving
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <math.h>
+#include "deferred_carver.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+
+// Result of test_view
+#define VIEW_INSIDE     0
+#define VIEW_REMOVED    1   // outside the silhouette
+#define VIEW_OUTSIDE    2   // outside the camera image
+
+// Constructor: max_views is the number of silhouettes that can be stored
+DeferredCarver::DeferredCarver(const CameraModel &camera, int max_views)
+    : camera(camera), max_views(max_views) {
+    init(camera.width, camera.height);
+}
+
+// Constructor: stores at most max_size pixels of each view (the largest region of interest)
+DeferredCarver::DeferredCarver(const CameraModel &camera, int max_views, Size max_size)
+    : camera(camera), max_views(max_views) {
+    init(max_size.width, max_size.height);
+}
+
+// Allocates the silhouette storage
+void DeferredCarver::init(int max_width, int max_height) {
+    rows = max_height;
+    words = (max_width + 31) / 32;
+    bits = new uint32_t[(size_t)max_views * rows * words];
+    projectors = new Projector<geom_t>[max_views];
+    area = new int[max_views];
+    order = new int[max_views];
+    clear();
+}
+
+// Forgets all stored views (call before each scan)
+void DeferredCarver::clear() {
+    count = 0;
+    lookup_count = 0;
+}
+
+// Stores the silhouette of a view taken at the turntable angle rad.
+// Returns false when there is no room left.
+bool DeferredCarver::add_view(const Mat &img_silhouette, double rad) {
+    return add_view(img_silhouette, rad, Rect(0, 0, camera.width, camera.height));
+}
+
+// Stores the silhouette of the region roi of a view (pixels outside it are background).
+// Returns false when there is no room left or the region is larger than the storage.
+bool DeferredCarver::add_view(const Mat &img_silhouette, double rad, const Rect &roi) {
+    TRACE_SCOPE("store_silhouette");
+    if (count >= max_views || roi.height > rows || roi.width > words * 32) return false;
+
+    uint32_t *dst = bits + (size_t)count * rows * words;
+    int pixels = 0;
+    for (int v = 0; v < roi.height; v++, dst += words) {
+        const unsigned char *src = img_silhouette.ptr<unsigned char>(v);
+        for (int w = 0; w < words; w++) {
+            uint32_t word = 0;
+            int end = (w * 32 + 32 < roi.width) ? 32 : roi.width - w * 32;
+            for (int b = 0; b < end; b++) {
+                if (src[w * 32 + b]) {
+                    word |= (uint32_t)1 << b;
+                    pixels++;
+                }
+            }
+            dst[w] = word;
+        }
+    }
+
+    projectors[count] = Projector<geom_t>(crop_camera(camera, roi), rad);
+    area[count] = pixels;
+    count++;
+    return true;
+}
+
+// Tests a 3D point against a stored view (same projection as shape_from_silhouette)
+inline int DeferredCarver::test_view(int view, geom_t Xw, geom_t Yw, geom_t Zw) const {
+    int u, v;
+    if (!projectors[view].project(Xw, Yw, Zw, u, v)) return VIEW_OUTSIDE;
+
+    const uint32_t *row = bits + ((size_t)view * rows + v) * words;
+    return ((row[u >> 5] >> (u & 31)) & 1) ? VIEW_INSIDE : VIEW_REMOVED;
+}
+
+// Carves the point cloud with all stored views in one pass
+CarveStats DeferredCarver::carve(PointCloud &point_cloud) {
+    TRACE_SCOPE("carve_deferred");
+    CarveStats stats = { 0, 0, 0 };
+    lookup_count = 0;
+    if (count == 0) return stats;
+
+    // Smallest silhouettes first: they reject the most voxels
+    for (int i = 0; i < count; i++) {
+        int view = i;
+        int j = i;
+        for (; j > 0 && area[order[j-1]] > area[view]; j--) order[j] = order[j-1];
+        order[j] = view;
+    }
+
+    // Check each voxels
+    const geom_t scale = geom_t(point_cloud.SCALE);
+    geom_t xx,yy,zz;    // 3D point(x,y,z)
+    int last = 0;       // index in order of the view that rejected the previous voxel
+
+    zz = geom_t((-point_cloud.SIZE / 2) * point_cloud.SCALE);
+    for (int z=0; z<point_cloud.SIZE; z++, zz += scale) {
+
+        yy = geom_t((-point_cloud.SIZE / 2) * point_cloud.SCALE);
+        for (int y=0; y<point_cloud.SIZE; y++, yy += scale) {
+
+            xx = geom_t((-point_cloud.SIZE / 2) * point_cloud.SCALE);
+            for (int x=0; x<point_cloud.SIZE; x++, xx += scale) {
+                if (point_cloud.get(x, y, z) == 0) continue;
+                stats.tested++;
+
+                // Try the last rejecting view, then the others in order
+                int result = VIEW_INSIDE;
+                for (int i = -1; i < count && result == VIEW_INSIDE; i++) {
+                    int k = (i < 0) ? last : i;
+                    if (i == last) continue;
+                    lookup_count++;
+                    result = test_view(order[k], xx, yy, zz);
+                    if (result != VIEW_INSIDE) last = k;
+                }
+
+                if (result == VIEW_REMOVED) {
+                    // Delete the point because it is outside a shilhouette
+                    point_cloud.set(x, y, z, 0);
+                    stats.removed++;
+                } else if (result == VIEW_OUTSIDE) {
+                    // Delete the point because it is outside a camera image
+                    point_cloud.set(x, y, z, 0);
+                    stats.outside++;
+                }
+            }
+        }
+    }
+
+    return stats;
+}
@@ -0,0 +1,74 @@
+/*
+** Deferred multi-view carving
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef DEFERRED_CARVER_HPP
+#define DEFERRED_CARVER_HPP
+
+#include <stdint.h>
+#include "opencv.hpp"
+#include "tinypcl.hpp"
+#include "reconstruction.hpp"
+
+// Carves all views in a single pass over the grid.
+//
+// Silhouettes are stored bit-packed (1 bit per pixel, 37.5 KB at 640x480) while the
+// turntable turns, then carve() tests each voxel against the views in order of
+// increasing silhouette area and stops at the first view that rejects it. The view
+// that rejected the previous voxel is tried first, since neighbouring voxels are
+// usually carved by the same view.
+//
+// Views may be cropped to their region of interest (see grid_roi): only max_size
+// pixels of each view are then stored.
+class DeferredCarver {
+public:
+    DeferredCarver(const CameraModel &camera, int max_views);
+    DeferredCarver(const CameraModel &camera, int max_views, cv::Size max_size);
+
+    void clear();
+    bool add_view(const cv::Mat &img_silhouette, double rad);
+    bool add_view(const cv::Mat &img_silhouette, double rad, const cv::Rect &roi);
+    CarveStats carve(PointCloud &point_cloud);
+
+    int views() const { return count; }
+    long lookups() const { return lookup_count; }
+private:
+    CameraModel camera;
+    int max_views;
+    int count;              // number of stored views
+    int rows;               // stored rows per view
+    int words;              // 32-bit words per stored row
+    long lookup_count;      // silhouette lookups of the last carve()
+
+    uint32_t *bits;         // bit-packed silhouettes (max_views x rows x words)
+    Projector<geom_t> *projectors;  // projection of each view
+    int *area;              // silhouette pixels of each view
+    int *order;             // views sorted by area
+
+    void init(int max_width, int max_height);
+    int test_view(int view, geom_t Xw, geom_t Yw, geom_t Zw) const;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*
+** Scalar types of the geometry code
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef GEOMETRY_HPP
+#define GEOMETRY_HPP
+
+#include <stdint.h>
+#include <math.h>
+
+// Scalar types of the per-voxel and per-cube geometry (projection, marching cubes, normals)
+#define GEOMETRY_DOUBLE     0   // Reference
+#define GEOMETRY_FLOAT      1   // Single precision (VFP/NEON)
+#define GEOMETRY_FIXED      2   // Q16.16 fixed point (integer unit only)
+
+// Selected type (mbed_app.json "geometry-scalar", or -DGEOMETRY_SCALAR=n on host builds)
+#ifndef GEOMETRY_SCALAR
+#ifdef MBED_CONF_APP_GEOMETRY_SCALAR
+#define GEOMETRY_SCALAR MBED_CONF_APP_GEOMETRY_SCALAR
+#else
+#define GEOMETRY_SCALAR GEOMETRY_DOUBLE
+#endif
+#endif
+
+// Also run the double reference and record the error in geometry_error
+// (mbed_app.json "geometry-validate", or -DGEOMETRY_VALIDATE=1 on host builds)
+#ifndef GEOMETRY_VALIDATE
+#ifdef MBED_CONF_APP_GEOMETRY_VALIDATE
+#define GEOMETRY_VALIDATE MBED_CONF_APP_GEOMETRY_VALIDATE
+#else
+#define GEOMETRY_VALIDATE 0
+#endif
+#endif
+
+// Q16.16 fixed point number (range +-32767, resolution 1/65536)
+class Fixed16 {
+public:
+    Fixed16() : raw(0) {}
+    explicit Fixed16(int i) : raw((int32_t)i << 16) {}
+    explicit Fixed16(double d) : raw((int32_t)(d * 65536.0 + ((d < 0) ? -0.5 : 0.5))) {}
+
+    static Fixed16 from_raw(int32_t raw) { Fixed16 f; f.raw = raw; return f; }
+
+    Fixed16 operator-() const { return from_raw(-raw); }
+    Fixed16 operator+(Fixed16 b) const { return from_raw(raw + b.raw); }
+    Fixed16 operator-(Fixed16 b) const { return from_raw(raw - b.raw); }
+    Fixed16 operator*(Fixed16 b) const { return from_raw((int32_t)(((int64_t)raw * b.raw) >> 16)); }
+    Fixed16 operator/(Fixed16 b) const { return from_raw((int32_t)(((int64_t)raw << 16) / b.raw)); }
+    Fixed16& operator+=(Fixed16 b) { raw += b.raw; return *this; }
+    Fixed16& operator-=(Fixed16 b) { raw -= b.raw; return *this; }
+    Fixed16& operator*=(Fixed16 b) { return *this = *this * b; }
+    Fixed16& operator/=(Fixed16 b) { return *this = *this / b; }
+
+    bool operator<(Fixed16 b) const { return raw < b.raw; }
+    bool operator>(Fixed16 b) const { return raw > b.raw; }
+    bool operator==(Fixed16 b) const { return raw == b.raw; }
+    bool operator!=(Fixed16 b) const { return raw != b.raw; }
+
+    int32_t raw;
+};
+
+// Scalar helpers, overloaded for each type
+inline double to_double(double x) { return x; }
+inline double to_double(float x) { return x; }
+inline double to_double(Fixed16 x) { return x.raw / 65536.0; }
+
+inline double scalar_abs(double x) { return fabs(x); }
+inline float scalar_abs(float x) { return fabsf(x); }
+inline Fixed16 scalar_abs(Fixed16 x) { return (x.raw < 0) ? -x : x; }
+
+inline double scalar_sqrt(double x) { return sqrt(x); }
+inline float scalar_sqrt(float x) { return sqrtf(x); }
+inline Fixed16 scalar_sqrt(Fixed16 x) {
+    // Integer square root of raw << 16
+    if (x.raw <= 0) return Fixed16();
+    uint64_t n = (uint64_t)x.raw << 16, root = 0, bit = (uint64_t)1 << 62;
+    while (bit > n) bit >>= 2;
+    while (bit) {
+        if (n >= root + bit) {
+            n -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return Fixed16::from_raw((int32_t)root);
+}
+
+// Returns a*b/c. Floating point keeps the (a/c)*b order of projection(); fixed point
+// multiplies first with a 64-bit intermediate, so only the final division rounds.
+inline double scalar_muldiv(double a, double b, double c) { return (a/c)*b; }
+inline float scalar_muldiv(float a, float b, float c) { return (a/c)*b; }
+inline Fixed16 scalar_muldiv(Fixed16 a, Fixed16 b, Fixed16 c) {
+    return Fixed16::from_raw((int32_t)(((int64_t)a.raw * b.raw) / c.raw));
+}
+
+// Truncates toward zero like (int)
+inline int scalar_trunc(double x) { return (int)x; }
+inline int scalar_trunc(float x) { return (int)x; }
+inline int scalar_trunc(Fixed16 x) { return (x.raw < 0) ? -(-x.raw >> 16) : (x.raw >> 16); }
+
+#if GEOMETRY_SCALAR == GEOMETRY_DOUBLE
+typedef double geom_t;
+#define GEOMETRY_NAME "double"
+#elif GEOMETRY_SCALAR == GEOMETRY_FLOAT
+typedef float geom_t;
+#define GEOMETRY_NAME "float"
+#elif GEOMETRY_SCALAR == GEOMETRY_FIXED
+typedef Fixed16 geom_t;
+#define GEOMETRY_NAME "Q16.16"
+#else
+#error "unknown GEOMETRY_SCALAR"
+#endif
+
+// Error of geom_t against the double reference (GEOMETRY_VALIDATE)
+typedef struct {
+    unsigned long projections;          // Voxel projections compared
+    unsigned long pixel_mismatches;     // Projections that hit another pixel (or the image border)
+    unsigned long cells;                // Marching cubes cells compared
+    unsigned long cell_mismatches;      // Cells that gave another number of triangles
+    double max_vertex_error;            // Largest vertex distance (grid units)
+    double max_normal_error;            // Largest component difference of unit normals
+} GeometryError;
+
+extern GeometryError geometry_error;
+
+// Resets geometry_error
+void geometry_error_clear();
+
+#endif
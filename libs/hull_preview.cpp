@@ -0,0 +1,108 @@
+/*
+** Live preview of the visual hull
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <string.h>
+#include "hull_preview.hpp"
+#include "trace.hpp"
+
+// Colors (Y, Cb, Cr)
+#define PREVIEW_BACKGROUND_Y    41      // blue, like the turntable background
+#define PREVIEW_BACKGROUND_CB   240
+#define PREVIEW_BACKGROUND_CR   110
+
+// Constructor: Initializes HullPreview
+HullPreview::HullPreview() {
+    buffer = new uint8_t[PREVIEW_WIDTH * PREVIEW_HEIGHT * 2];
+    heights = new unsigned short[PCD_SIZE * PCD_SIZE];
+    clear();
+}
+
+// Starts from the full grid (call before each scan)
+void HullPreview::clear() {
+    // Fill the background, including the padding outside the grid
+    for (int i = 0; i < PREVIEW_WIDTH * PREVIEW_HEIGHT * 2; i += 4) {
+        buffer[i + 0] = PREVIEW_BACKGROUND_Y;
+        buffer[i + 1] = PREVIEW_BACKGROUND_CB;
+        buffer[i + 2] = PREVIEW_BACKGROUND_Y;
+        buffer[i + 3] = PREVIEW_BACKGROUND_CR;
+    }
+
+    for (int y = 0; y < PCD_SIZE; y++) {
+        for (int x = 0; x < PCD_SIZE; x++) {
+            heights[x + y * PCD_SIZE] = PCD_SIZE;
+            draw_column(x, y);
+        }
+    }
+}
+
+// Updates the columns whose top voxel has been carved, returns the number of redrawn columns
+int HullPreview::update(const PointCloud &point_cloud) {
+    TRACE_SCOPE("hull_preview");
+    int changed = 0;
+
+    for (int y = 0; y < PCD_SIZE; y++) {
+        for (int x = 0; x < PCD_SIZE; x++) {
+            unsigned short &height = heights[x + y * PCD_SIZE];
+            if (height == 0 || point_cloud.get(x, y, height - 1)) continue;
+
+            // The top voxel is gone, look for the next one below
+            int z = height - 2;
+            while (z >= 0 && point_cloud.get(x, y, z) == 0) z--;
+            height = z + 1;
+
+            draw_column(x, y);
+            changed++;
+        }
+    }
+
+    return changed;
+}
+
+// Draws a column as a PREVIEW_SCALE x PREVIEW_SCALE block (+y is up)
+void HullPreview::draw_column(int x, int y) {
+    int height = heights[x + y * PCD_SIZE];
+    uint8_t luma, cb, cr;
+    if (height == 0) {
+        luma = PREVIEW_BACKGROUND_Y;
+        cb = PREVIEW_BACKGROUND_CB;
+        cr = PREVIEW_BACKGROUND_CR;
+    } else {
+        luma = 16 + (219 * height) / PCD_SIZE;
+        cb = cr = 128;
+    }
+
+    int v0 = (PCD_SIZE - 1 - y) * PREVIEW_SCALE;
+    for (int v = v0; v < v0 + PREVIEW_SCALE; v++) {
+        uint8_t *pixel = buffer + (v * PREVIEW_WIDTH + x * PREVIEW_SCALE) * 2;
+        for (int u = 0; u < PREVIEW_SCALE; u += 2, pixel += 4) {
+            pixel[0] = luma;
+            pixel[1] = cb;
+            pixel[2] = luma;
+            pixel[3] = cr;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+/*
+** Live preview of the visual hull
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef HULL_PREVIEW_HPP
+#define HULL_PREVIEW_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tinypcl.hpp"
+
+// Preview parameters
+#define PREVIEW_SCALE   4   // pixels per voxel column (even: YCbCr422 pixel pairs share chroma)
+#define PREVIEW_WIDTH   (((PCD_SIZE * PREVIEW_SCALE) + 15) & ~15)   // the JPEG encoder works on 16x8 blocks
+#define PREVIEW_HEIGHT  (((PCD_SIZE * PREVIEW_SCALE) + 7) & ~7)
+
+// Top-down height map of the current visual hull (YCbCr422, brighter is higher).
+//
+// Carving only removes voxels, so a column changes only when its top voxel is gone.
+// update() checks that one voxel per column, rescans just the changed columns downward
+// and redraws their pixels; the rest of the image is kept from the previous view.
+class HullPreview {
+public:
+    HullPreview();
+
+    void clear();
+    int update(const PointCloud &point_cloud);
+
+    uint8_t* image() { return buffer; }
+    size_t image_size() const { return PREVIEW_WIDTH * PREVIEW_HEIGHT * 2; }
+private:
+    uint8_t *buffer;            // PREVIEW_WIDTH x PREVIEW_HEIGHT, 2 bytes per pixel
+    unsigned short *heights;    // top voxel + 1 of each column (0: empty)
+
+    void draw_column(int x, int y);
+};
+
+#endif
@@ -6,21 +6,108 @@
 ** May 1994
 ** http://paulbourke.net/geometry/polygonise/
 */
+#ifndef MARCHINGCUBES_HPP
+#define MARCHINGCUBES_HPP
 
-typedef struct {
-    float x;
-    float y;
-    float z;
-} XYZ;
+#include "geometry.hpp"
 
-typedef struct {
-   XYZ p[3];
-} TRIANGLE;
+// The geometry is templated on its scalar type T (double, float or Fixed16)
+template <typename T> struct XYZ_T {
+    T x;
+    T y;
+    T z;
+};
 
-typedef struct {
-   XYZ p[8];
-   double val[8];
-} GRIDCELL;
+template <typename T> struct TRIANGLE_T {
+   XYZ_T<T> p[3];
+};
 
-int Polygonise(GRIDCELL ,double ,TRIANGLE *);
-XYZ VertexInterp(double, XYZ, XYZ, double, double);
+template <typename T> struct GRIDCELL_T {
+   XYZ_T<T> p[8];
+   T val[8];
+};
+
+// Mesh output (what the sinks receive)
+typedef XYZ_T<float> XYZ;
+typedef TRIANGLE_T<float> TRIANGLE;
+
+extern const int edgeTable[256];
+extern const int triTable[256][16];
+
+/*
+   Linearly interpolate the position where an isosurface cuts
+   an edge between two vertices, each with their own scalar value
+*/
+template <typename T>
+XYZ_T<T> VertexInterp(T isolevel, const XYZ_T<T> &p1, const XYZ_T<T> &p2, T valp1, T valp2)
+{
+   const T epsilon = T(0.00001);
+   T mu;
+   XYZ_T<T> p;
+
+   if (scalar_abs(isolevel-valp1) < epsilon)
+      return(p1);
+   if (scalar_abs(isolevel-valp2) < epsilon)
+      return(p2);
+   if (scalar_abs(valp1-valp2) < epsilon)
+      return(p1);
+   mu = (isolevel - valp1) / (valp2 - valp1);
+   p.x = p1.x + mu * (p2.x - p1.x);
+   p.y = p1.y + mu * (p2.y - p1.y);
+   p.z = p1.z + mu * (p2.z - p1.z);
+
+   return(p);
+}
+
+/*
+   Given a grid cell and an isolevel, calculate the triangular
+   facets required to represent the isosurface through the cell.
+   Return the number of triangular facets, the array "triangles"
+   will be loaded up with the vertices at most 5 triangular facets.
+	0 will be returned if the grid cell is either totally above
+   of totally below the isolevel.
+*/
+template <typename T>
+int Polygonise(const GRIDCELL_T<T> &grid, T isolevel, TRIANGLE_T<T> *triangles)
+{
+   static const int edges[12][2] = {
+      {0,1}, {1,2}, {2,3}, {3,0}, {4,5}, {5,6}, {6,7}, {7,4}, {0,4}, {1,5}, {2,6}, {3,7}
+   };
+   int i,ntriang;
+   int cubeindex;
+   XYZ_T<T> vertlist[12];
+
+   /*
+      Determine the index into the edge table which
+      tells us which vertices are inside of the surface
+   */
+   cubeindex = 0;
+   for (i=0;i<8;i++) {
+      if (grid.val[i] < isolevel) cubeindex |= 1 << i;
+   }
+
+   /* Cube is entirely in/out of the surface */
+   if (edgeTable[cubeindex] == 0)
+      return(0);
+
+   /* Find the vertices where the surface intersects the cube */
+   for (i=0;i<12;i++) {
+      if (edgeTable[cubeindex] & (1 << i)) {
+         int a = edges[i][0], b = edges[i][1];
+         vertlist[i] = VertexInterp(isolevel,grid.p[a],grid.p[b],grid.val[a],grid.val[b]);
+      }
+   }
+
+   /* Create the triangle */
+   ntriang = 0;
+   for (i=0;triTable[cubeindex][i]!=-1;i+=3) {
+      triangles[ntriang].p[0] = vertlist[triTable[cubeindex][i  ]];
+      triangles[ntriang].p[1] = vertlist[triTable[cubeindex][i+1]];
+      triangles[ntriang].p[2] = vertlist[triTable[cubeindex][i+2]];
+      ntriang++;
+   }
+
+   return(ntriang);
+}
+
+#endif
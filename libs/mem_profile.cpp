@@ -0,0 +1,309 @@
+/*
+** Heap and stack profiling per pipeline stage
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <string.h>
+#include "mem_profile.hpp"
+
+#ifdef __MBED__
+#include "mbed.h"
+#define MEMPROF_EOL "\r\n"
+#else
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#define MEMPROF_EOL "\n"
+#endif
+
+#define MEMPROF_MARKS   16      // host: scopes whose heap peak is followed at the same time
+#define MEMPROF_THREADS 8       // device: threads in the stack report
+
+typedef struct {
+    const char *name;
+    size_t bytes;
+} MEMPROF_STATIC_BUFFER;
+
+static MEMPROF_STAGE stages[MEMPROF_STAGES];
+static int stage_count = 0;
+static MEMPROF_STATIC_BUFFER statics[MEMPROF_STATICS];
+static int static_count = 0;
+
+// Stages end in threads only (no TRACE_SCOPE in interrupt handlers)
+#ifdef __MBED__
+static Mutex memprof_mutex;
+#define memprof_lock()   memprof_mutex.lock()
+#define memprof_unlock() memprof_mutex.unlock()
+#else
+static pthread_mutex_t memprof_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define memprof_lock()   pthread_mutex_lock(&memprof_mutex)
+#define memprof_unlock() pthread_mutex_unlock(&memprof_mutex)
+#endif
+
+#if MEMPROF_ENABLE && !defined(__MBED__)
+// Host: malloc hooks (glibc) counting the usable size of each block
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *ptr);
+}
+
+static volatile size_t heap_current = 0;
+static volatile size_t heap_peak = 0;
+static volatile uint32_t heap_allocs = 0;
+static volatile uint64_t heap_bytes = 0;
+static volatile size_t marks[MEMPROF_MARKS];    // heap peak since each MemScope began
+static volatile uint32_t marks_used = 0;        // bit i: marks[i] belongs to a scope
+
+static void atomic_max(volatile size_t *value, size_t candidate) {
+    size_t old = *value;
+    while (candidate > old) {
+        size_t seen = __sync_val_compare_and_swap(value, old, candidate);
+        if (seen == old) break;
+        old = seen;
+    }
+}
+
+static void heap_add(void *ptr) {
+    if (ptr == NULL) return;
+    size_t size = malloc_usable_size(ptr);
+    size_t current = __sync_add_and_fetch(&heap_current, size);
+    __sync_fetch_and_add(&heap_allocs, 1);
+    __sync_fetch_and_add(&heap_bytes, (uint64_t)size);
+    atomic_max(&heap_peak, current);
+    for (uint32_t used = marks_used, i = 0; used != 0; used >>= 1, i++) {
+        if (used & 1) atomic_max(&marks[i], current);
+    }
+}
+
+static void heap_remove(void *ptr) {
+    if (ptr == NULL) return;
+    __sync_fetch_and_sub(&heap_current, malloc_usable_size(ptr));
+}
+
+extern "C" {
+void *malloc(size_t size) __THROW {
+    void *ptr = __libc_malloc(size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size) __THROW {
+    void *ptr = __libc_calloc(count, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) __THROW {
+    size_t old = ptr != NULL ? malloc_usable_size(ptr) : 0;
+    void *result = __libc_realloc(ptr, size);
+    if (result != NULL || size == 0) {
+        __sync_fetch_and_sub(&heap_current, old);
+        heap_add(result);
+    }
+    return result;
+}
+
+void *memalign(size_t alignment, size_t size) __THROW {
+    void *ptr = __libc_memalign(alignment, size);
+    heap_add(ptr);
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) __THROW {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **result, size_t alignment, size_t size) __THROW {
+    void *ptr = __libc_memalign(alignment, size);
+    if (ptr == NULL) return ENOMEM;
+    heap_add(ptr);
+    *result = ptr;
+    return 0;
+}
+
+void free(void *ptr) __THROW {
+    heap_remove(ptr);
+    __libc_free(ptr);
+}
+}
+#endif
+
+// Returns the current heap state
+void memprof_heap(MEMPROF_HEAP &heap) {
+#ifdef __MBED__
+    mbed_stats_heap_t stats;
+    mbed_stats_heap_get(&stats);
+    heap.current = stats.current_size;
+    heap.peak = stats.max_size;
+    heap.allocs = stats.alloc_cnt;
+    heap.bytes = stats.total_size;
+#elif MEMPROF_ENABLE
+    heap.current = heap_current;
+    heap.peak = heap_peak;
+    heap.allocs = heap_allocs;
+    heap.bytes = heap_bytes;
+#else
+    memset(&heap, 0, sizeof(heap));
+#endif
+}
+
+// Records the size of a static buffer for the report
+void memprof_static(const char *name, size_t bytes) {
+    memprof_lock();
+    for (int i = 0; i < static_count; i++) {
+        if (strcmp(statics[i].name, name) == 0) {
+            statics[i].bytes = bytes;
+            memprof_unlock();
+            return;
+        }
+    }
+    if (static_count < MEMPROF_STATICS) {
+        statics[static_count].name = name;
+        statics[static_count].bytes = bytes;
+        static_count++;
+    }
+    memprof_unlock();
+}
+
+// Discards the stage statistics
+void memprof_clear(void) {
+    memprof_lock();
+    stage_count = 0;
+    memprof_unlock();
+}
+
+// Returns the index of a stage (stage_count if it is new). A stage is mostly named by
+// the same string literal, so the pointers are compared before the strings.
+static int find_stage(const char *name) {
+    for (int i = 0; i < stage_count; i++) {
+        if (stages[i].name == name) return i;
+    }
+    for (int i = 0; i < stage_count; i++) {
+        if (strcmp(stages[i].name, name) == 0) return i;
+    }
+    return stage_count;
+}
+
+MemScope::MemScope(const char *name) : name(name), mark(-1) {
+    memprof_heap(entry);
+#if MEMPROF_ENABLE && !defined(__MBED__)
+    // Take a free mark, starting from the heap at entry
+    for (int i = 0; i < MEMPROF_MARKS && mark < 0; i++) {
+        uint32_t used = marks_used;
+        if (used & (1u << i)) continue;
+        marks[i] = entry.current;
+        if (__sync_bool_compare_and_swap(&marks_used, used, used | (1u << i))) mark = i;
+    }
+#endif
+}
+
+MemScope::~MemScope() {
+    MEMPROF_HEAP exit;
+    memprof_heap(exit);
+
+    size_t peak = exit.current > entry.current ? exit.current - entry.current : 0;
+#if MEMPROF_ENABLE && !defined(__MBED__)
+    if (mark >= 0) {
+        if (marks[mark] > entry.current) peak = marks[mark] - entry.current;
+        __sync_fetch_and_and(&marks_used, ~(1u << mark));
+    }
+#else
+    // The heap high-water mark only says something when the stage raised it
+    if (exit.peak > entry.peak) peak = exit.peak - entry.current;
+#endif
+
+    memprof_lock();
+    int i = find_stage(name);
+    if (i == stage_count) {
+        if (stage_count == MEMPROF_STAGES) {
+            memprof_unlock();
+            return;
+        }
+        memset(&stages[i], 0, sizeof(stages[i]));
+        stages[i].name = name;
+        stage_count++;
+    }
+    MEMPROF_STAGE &stage = stages[i];
+    stage.calls++;
+    stage.allocs += exit.allocs - entry.allocs;
+    stage.bytes += exit.bytes - entry.bytes;
+    if (peak > stage.peak) stage.peak = peak;
+    stage.retained += (long)exit.current - (long)entry.current;
+    memprof_unlock();
+}
+
+// Prints the memory report
+void memprof_report(FILE *fp) {
+    MEMPROF_HEAP heap;
+    memprof_heap(heap);
+    fprintf(fp, "Memory: heap %lu bytes in use, peak %lu bytes, %lu allocations, %lu KB allocated" MEMPROF_EOL,
+            (unsigned long)heap.current, (unsigned long)heap.peak, (unsigned long)heap.allocs,
+            (unsigned long)(heap.bytes / 1024));
+
+    // Stages, largest peak first
+    memprof_lock();
+    int count = stage_count;
+    MEMPROF_STAGE sorted[MEMPROF_STAGES];
+    memcpy(sorted, stages, count * sizeof(MEMPROF_STAGE));
+    memprof_unlock();
+    for (int i = 1; i < count; i++) {
+        MEMPROF_STAGE stage = sorted[i];
+        int j = i;
+        for (; j > 0 && sorted[j - 1].peak < stage.peak; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = stage;
+    }
+    fprintf(fp, "  %-24s %6s %8s %12s %10s %10s" MEMPROF_EOL, "stage", "calls", "allocs", "bytes", "peak", "retained");
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "  %-24s %6lu %8lu %12lu %10lu %10ld" MEMPROF_EOL, sorted[i].name,
+                (unsigned long)sorted[i].calls, (unsigned long)sorted[i].allocs, (unsigned long)sorted[i].bytes,
+                (unsigned long)sorted[i].peak, sorted[i].retained);
+    }
+
+    // Static buffers
+    size_t total = 0;
+    for (int i = 0; i < static_count; i++) {
+        fprintf(fp, "  static %-17s %39lu" MEMPROF_EOL, statics[i].name, (unsigned long)statics[i].bytes);
+        total += statics[i].bytes;
+    }
+    if (static_count > 0) fprintf(fp, "  static total %50lu" MEMPROF_EOL, (unsigned long)total);
+
+    // Thread stacks
+#ifdef __MBED__
+    mbed_stats_stack_t stacks[MEMPROF_THREADS];
+    size_t threads = mbed_stats_stack_get_each(stacks, MEMPROF_THREADS);
+    for (size_t i = 0; i < threads; i++) {
+        fprintf(fp, "  stack %08lx %44lu of %lu" MEMPROF_EOL, (unsigned long)stacks[i].thread_id,
+                (unsigned long)stacks[i].max_size, (unsigned long)stacks[i].reserved_size);
+    }
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(fp, "  max resident %49ld KB (stacks are not measured on the host)" MEMPROF_EOL, usage.ru_maxrss);
+#endif
+}
@@ -0,0 +1,104 @@
+/*
+** Heap and stack profiling per pipeline stage
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef MEM_PROFILE_HPP
+#define MEM_PROFILE_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Enable memory profiling (mbed_app.json "mem-profile", or -DMEMPROF_ENABLE=1 on host builds)
+#ifndef MEMPROF_ENABLE
+#ifdef MBED_CONF_APP_MEM_PROFILE
+#define MEMPROF_ENABLE MBED_CONF_APP_MEM_PROFILE
+#else
+#define MEMPROF_ENABLE 0
+#endif
+#endif
+
+#if MEMPROF_ENABLE && defined(__MBED__) && !defined(MBED_HEAP_STATS_ENABLED)
+#error "mem-profile needs MBED_HEAP_STATS_ENABLED=1 (and MBED_STACK_STATS_ENABLED=1) in target.macros_add"
+#endif
+
+// Number of stages and static buffers kept (by name)
+#ifndef MEMPROF_STAGES
+#define MEMPROF_STAGES 32
+#endif
+#define MEMPROF_STATICS 16
+
+// Heap state
+typedef struct {
+    size_t current;     // Bytes in use
+    size_t peak;        // High-water mark of current
+    uint32_t allocs;    // Allocations so far
+    uint64_t bytes;     // Bytes allocated so far
+} MEMPROF_HEAP;
+
+// Heap use of a stage, over all its calls
+typedef struct {
+    const char *name;   // Static string (only the pointer is stored)
+    uint32_t calls;
+    uint32_t allocs;    // Allocations while the stage ran (by any thread)
+    uint64_t bytes;     // Bytes allocated while the stage ran
+    size_t peak;        // Largest growth of the heap above its size at entry
+    long retained;      // Heap at exit - heap at entry, summed over the calls
+} MEMPROF_STAGE;
+
+// Returns the current heap state
+void memprof_heap(MEMPROF_HEAP &heap);
+
+// Records the size of a static buffer for the report
+void memprof_static(const char *name, size_t bytes);
+
+// Discards the stage statistics (the static buffers are kept)
+void memprof_clear(void);
+
+// Prints the heap, the stages (largest peak first), the static buffers and the thread stacks
+void memprof_report(FILE *fp);
+
+// Records the heap use during the lifetime of the object as a stage
+// On the device the heap is read from the mbed heap statistics, so the peak of a stage
+// is exact when the stage raises the high-water mark of the heap and a lower bound
+// otherwise. Host builds hook malloc and measure every peak.
+class MemScope {
+public:
+    MemScope(const char *name);
+    ~MemScope();
+private:
+    const char *name;
+    MEMPROF_HEAP entry;
+    int mark;           // Host: slot following the heap peak of this scope (-1: none)
+};
+
+// Syntax sugar to register a static buffer
+#if MEMPROF_ENABLE
+#define MEMPROF_STATIC(name, bytes) memprof_static(name, bytes)
+#else
+#define MEMPROF_STATIC(name, bytes)
+#endif
+
+#endif
@@ -0,0 +1,511 @@
+/*
+** Mesh decimation
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <math.h>
+#include <algorithm>
+#include <iterator>
+#include <queue>
+#include "mesh_decimator.hpp"
+#include "trace.hpp"
+
+// Never collapse an edge that turns a face by more than this (cosine of the angle)
+#define DECIMATE_MIN_COS    0.2
+
+// Initial size of the cell hash table (a power of 2)
+#define DECIMATE_TABLE_SIZE 1024
+
+// Constructor: the simplified mesh is fed to sinks
+DecimateSink::DecimateSink(MeshSink *sinks[], int sink_count, int mode, float ratio, float error, size_t max_triangles)
+    : sink_count(0), mode(mode), ratio(ratio), error(error), max_triangles(max_triangles),
+      input_count(0), output_count(0), passing(false), ok(true) {
+    for (int k=0; k<sink_count && k<MESH_MAX_SINKS; k++) {
+        this->sinks[this->sink_count++] = sinks[k];
+    }
+}
+
+// Starts the sinks (a sink that fails is dropped, as in generate_mesh)
+bool DecimateSink::begin() {
+    std::vector<XYZ>().swap(corners);
+    std::vector<ClusterCell>().swap(cells);
+    cell_table.assign(clustering() ? DECIMATE_TABLE_SIZE : 0, 0);
+    vertices.clear();
+    faces.clear();
+    input_count = output_count = 0;
+    passing = false;
+    ok = true;
+    for (int k=0; k<sink_count; k++) {
+        if (!sinks[k]->begin()) {
+            sinks[k--] = sinks[--sink_count];
+            ok = false;
+        }
+    }
+    return sink_count > 0;
+}
+
+bool DecimateSink::add(const XYZ &normal, const TRIANGLE &triangle) {
+    input_count++;
+    if (!passing && !clustering() && input_count > max_triangles) {
+        // Write the corners kept so far unchanged, then the rest as it comes
+        simplify();
+        passing = true;
+    }
+    if (passing) {
+        emit(normal, triangle);
+        return sink_count > 0;
+    }
+
+    if (clustering()) {
+        // A face with two corners in one cell collapses, so it is not kept
+        uint32_t v[3];
+        for (int j=0; j<3; j++) v[j] = cluster_corner(triangle.p[j]);
+        if (v[0] != v[1] && v[1] != v[2] && v[2] != v[0]) {
+            for (int j=0; j<3; j++) faces.push_back(v[j]);
+        }
+    } else {
+        for (int j=0; j<3; j++) corners.push_back(triangle.p[j]);
+    }
+    return true;
+}
+
+// Adds a corner to the sum of its cell, returns the cell number
+uint32_t DecimateSink::cluster_corner(const XYZ &p) {
+    int32_t x = (int32_t)floor(p.x / error);
+    int32_t y = (int32_t)floor(p.y / error);
+    int32_t z = (int32_t)floor(p.z / error);
+
+    // Open addressing, the table is kept at most half full
+    uint32_t mask = (uint32_t)cell_table.size() - 1;
+    uint32_t slot = ((uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u) & mask;
+    while (cell_table[slot] != 0) {
+        ClusterCell &cell = cells[cell_table[slot] - 1];
+        if (cell.x == x && cell.y == y && cell.z == z) break;
+        slot = (slot + 1) & mask;
+    }
+    if (cell_table[slot] == 0) {
+        ClusterCell cell = { x, y, z, 0, { 0, 0, 0 } };
+        cells.push_back(cell);
+        cell_table[slot] = (uint32_t)cells.size();
+        if (cells.size() * 2 > cell_table.size()) {
+            // Grow and insert the cells again
+            cell_table.assign(cell_table.size() * 2, 0);
+            mask = (uint32_t)cell_table.size() - 1;
+            for (uint32_t i=0; i<cells.size(); i++) {
+                const ClusterCell &c = cells[i];
+                uint32_t s = ((uint32_t)c.x * 73856093u ^ (uint32_t)c.y * 19349663u ^ (uint32_t)c.z * 83492791u) & mask;
+                while (cell_table[s] != 0) s = (s + 1) & mask;
+                cell_table[s] = i + 1;
+            }
+            slot = 0xffffffff;
+        }
+    }
+
+    uint32_t number = (slot == 0xffffffff) ? (uint32_t)cells.size() - 1 : cell_table[slot] - 1;
+    ClusterCell &cell = cells[number];
+    cell.sum[0] += p.x;
+    cell.sum[1] += p.y;
+    cell.sum[2] += p.z;
+    cell.count++;
+    return number;
+}
+
+// Vertex clustering: each cell becomes the mean of its corners
+void DecimateSink::cluster_means() {
+    vertices.resize(cells.size());
+    for (uint32_t i=0; i<cells.size(); i++) {
+        const ClusterCell &cell = cells[i];
+        XYZ mean = { (float)(cell.sum[0] / cell.count), (float)(cell.sum[1] / cell.count), (float)(cell.sum[2] / cell.count) };
+        vertices[i] = mean;
+    }
+    std::vector<ClusterCell>().swap(cells);
+    std::vector<uint32_t>().swap(cell_table);
+}
+
+// Orders the corners by position
+struct CornerLess {
+    const std::vector<XYZ> &corners;
+    CornerLess(const std::vector<XYZ> &corners) : corners(corners) {}
+    bool operator()(uint32_t a, uint32_t b) const {
+        const XYZ &p = corners[a], &q = corners[b];
+        if (p.x != q.x) return p.x < q.x;
+        if (p.y != q.y) return p.y < q.y;
+        if (p.z != q.z) return p.z < q.z;
+        return a < b;
+    }
+};
+
+// Merges identical corners into vertices and builds the faces
+void DecimateSink::index_corners() {
+    std::vector<uint32_t> order(corners.size());
+    for (uint32_t i=0; i<order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), CornerLess(corners));
+
+    faces.resize(corners.size());
+    for (uint32_t i=0; i<order.size(); i++) {
+        const XYZ &p = corners[order[i]];
+        if (i == 0 || p.x != vertices.back().x || p.y != vertices.back().y || p.z != vertices.back().z) {
+            vertices.push_back(p);
+        }
+        faces[order[i]] = (uint32_t)vertices.size() - 1;
+    }
+    std::vector<XYZ>().swap(corners);
+}
+
+// Symmetric 4x4 matrix of the squared distance to a set of planes
+struct Quadric {
+    double a[10];   // xx xy xz xw yy yz yw zz zw ww
+
+    Quadric() { for (int i=0; i<10; i++) a[i] = 0; }
+    void add_plane(double nx, double ny, double nz, double d) {
+        a[0] += nx*nx; a[1] += nx*ny; a[2] += nx*nz; a[3] += nx*d;
+        a[4] += ny*ny; a[5] += ny*nz; a[6] += ny*d;
+        a[7] += nz*nz; a[8] += nz*d;
+        a[9] += d*d;
+    }
+    void add(const Quadric &q) { for (int i=0; i<10; i++) a[i] += q.a[i]; }
+    double error(const XYZ &p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+             + a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+             + a[7]*z*z + 2*a[8]*z + a[9];
+    }
+};
+
+// Candidate collapse of the edge (v0,v1) into v0 at target
+struct Collapse {
+    double cost;
+    uint32_t v0, v1;
+    uint32_t stamp0, stamp1;    // vertex stamps when the cost was computed
+    XYZ target;
+    bool operator<(const Collapse &other) const { return cost > other.cost; }   // cheapest first
+};
+
+// Collapse of (v0,v1) to the cheapest of the endpoints and the midpoint
+static Collapse make_collapse(const std::vector<XYZ> &vertices, const std::vector<Quadric> &quadrics,
+                              const std::vector<uint32_t> &stamps, uint32_t v0, uint32_t v1) {
+    Quadric q = quadrics[v0];
+    q.add(quadrics[v1]);
+    const XYZ &p0 = vertices[v0], &p1 = vertices[v1];
+    XYZ mid = { (p0.x + p1.x) / 2, (p0.y + p1.y) / 2, (p0.z + p1.z) / 2 };
+    const XYZ *targets[3] = { &p0, &p1, &mid };
+    Collapse c;
+    c.cost = -1;
+    for (int i=0; i<3; i++) {
+        double cost = q.error(*targets[i]);
+        if (c.cost < 0 || cost < c.cost) {
+            c.cost = cost;
+            c.target = *targets[i];
+        }
+    }
+    c.v0 = v0;
+    c.v1 = v1;
+    c.stamp0 = stamps[v0];
+    c.stamp1 = stamps[v1];
+    return c;
+}
+
+// Unnormalized normal of a triangle
+static void face_normal(const XYZ &a, const XYZ &b, const XYZ &c, double n[3]) {
+    double ab[3] = { b.x - a.x, b.y - a.y, b.z - a.z };
+    double ac[3] = { c.x - a.x, c.y - a.y, c.z - a.z };
+    n[0] = ab[1]*ac[2] - ab[2]*ac[1];
+    n[1] = ab[2]*ac[0] - ab[0]*ac[2];
+    n[2] = ab[0]*ac[1] - ab[1]*ac[0];
+}
+
+// Quadric edge collapse (Garland and Heckbert) with the endpoints or the midpoint as target,
+// until ratio of the faces is left or the cheapest collapse moves the surface by error mm
+void DecimateSink::collapse() {
+    const uint32_t vertex_count = (uint32_t)vertices.size();
+    const uint32_t face_count = (uint32_t)faces.size() / 3;
+    std::vector<Quadric> quadrics(vertex_count);
+    std::vector<std::vector<uint32_t> > vertex_faces(vertex_count);
+    std::vector<uint32_t> stamps(vertex_count, 0);
+    std::vector<bool> face_alive(face_count, true);
+    std::vector<bool> vertex_alive(vertex_count, true);
+
+    for (uint32_t f=0; f<face_count; f++) {
+        const XYZ &a = vertices[faces[f*3]], &b = vertices[faces[f*3+1]], &c = vertices[faces[f*3+2]];
+        double n[3];
+        face_normal(a, b, c, n);
+        double length = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if (length > 0) {
+            n[0] /= length; n[1] /= length; n[2] /= length;
+            double d = -(n[0]*a.x + n[1]*a.y + n[2]*a.z);
+            for (int j=0; j<3; j++) quadrics[faces[f*3+j]].add_plane(n[0], n[1], n[2], d);
+        }
+        for (int j=0; j<3; j++) vertex_faces[faces[f*3+j]].push_back(f);
+    }
+
+    std::priority_queue<Collapse> heap;
+    for (uint32_t f=0; f<face_count; f++) {
+        for (int j=0; j<3; j++) {
+            uint32_t v0 = faces[f*3+j], v1 = faces[f*3+(j+1)%3];
+            if (v0 < v1) heap.push(make_collapse(vertices, quadrics, stamps, v0, v1));
+        }
+    }
+
+    uint32_t alive = face_count;
+    const uint32_t target = (uint32_t)(face_count * ratio);
+    const double max_cost = (double)error * error;
+    std::vector<uint32_t> ring0, ring1;
+    while (alive > target && !heap.empty()) {
+        Collapse c = heap.top();
+        heap.pop();
+        if (c.cost > max_cost) break;
+        if (!vertex_alive[c.v0] || !vertex_alive[c.v1]) continue;
+        if (stamps[c.v0] != c.stamp0 || stamps[c.v1] != c.stamp1) continue;
+
+        // Neighbours of both ends, and the faces on the edge
+        ring0.clear();
+        ring1.clear();
+        int shared_faces = 0;
+        for (int e=0; e<2; e++) {
+            uint32_t v = e ? c.v1 : c.v0;
+            std::vector<uint32_t> &ring = e ? ring1 : ring0;
+            for (size_t i=0; i<vertex_faces[v].size(); i++) {
+                uint32_t f = vertex_faces[v][i];
+                if (!face_alive[f]) continue;
+                bool has0 = false, has1 = false;
+                for (int j=0; j<3; j++) {
+                    uint32_t w = faces[f*3+j];
+                    if (w == c.v0) has0 = true;
+                    if (w == c.v1) has1 = true;
+                    if (w != c.v0 && w != c.v1) ring.push_back(w);
+                }
+                if (e == 0 && has0 && has1) shared_faces++;
+            }
+            std::sort(ring.begin(), ring.end());
+            ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+        }
+
+        // Link condition: the ends share only the vertices opposite the edge (keeps the mesh manifold)
+        std::vector<uint32_t> common;
+        std::set_intersection(ring0.begin(), ring0.end(), ring1.begin(), ring1.end(), std::back_inserter(common));
+        if ((int)common.size() != shared_faces) continue;
+
+        // No face may flip or collapse
+        bool valid = true;
+        for (int e=0; e<2 && valid; e++) {
+            uint32_t v = e ? c.v1 : c.v0;
+            for (size_t i=0; i<vertex_faces[v].size() && valid; i++) {
+                uint32_t f = vertex_faces[v][i];
+                if (!face_alive[f]) continue;
+                XYZ before[3], after[3];
+                bool on_edge = false;
+                for (int j=0; j<3; j++) {
+                    uint32_t w = faces[f*3+j];
+                    before[j] = vertices[w];
+                    after[j] = (w == c.v0 || w == c.v1) ? c.target : vertices[w];
+                    if (w == (e ? c.v0 : c.v1)) on_edge = true;
+                }
+                if (on_edge) continue;
+                double n0[3], n1[3];
+                face_normal(before[0], before[1], before[2], n0);
+                face_normal(after[0], after[1], after[2], n1);
+                double dot = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2];
+                double l0 = sqrt(n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2]);
+                double l1 = sqrt(n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2]);
+                if (l1 == 0 || dot < DECIMATE_MIN_COS * l0 * l1) valid = false;
+            }
+        }
+        if (!valid) continue;
+
+        // Collapse v1 into v0
+        vertices[c.v0] = c.target;
+        quadrics[c.v0].add(quadrics[c.v1]);
+        vertex_alive[c.v1] = false;
+        stamps[c.v0]++;
+        for (size_t i=0; i<vertex_faces[c.v1].size(); i++) {
+            uint32_t f = vertex_faces[c.v1][i];
+            if (!face_alive[f]) continue;
+            bool has0 = false;
+            for (int j=0; j<3; j++) {
+                if (faces[f*3+j] == c.v0) has0 = true;
+            }
+            if (has0) {
+                face_alive[f] = false;
+                alive--;
+            } else {
+                for (int j=0; j<3; j++) {
+                    if (faces[f*3+j] == c.v1) faces[f*3+j] = c.v0;
+                }
+                vertex_faces[c.v0].push_back(f);
+            }
+        }
+        std::vector<uint32_t>().swap(vertex_faces[c.v1]);
+
+        // Drop the dead faces of v0 and queue its edges again
+        std::vector<uint32_t> &around = vertex_faces[c.v0];
+        size_t n = 0;
+        for (size_t i=0; i<around.size(); i++) {
+            if (face_alive[around[i]]) around[n++] = around[i];
+        }
+        around.resize(n);
+        ring0.clear();
+        for (size_t i=0; i<around.size(); i++) {
+            for (int j=0; j<3; j++) {
+                uint32_t w = faces[around[i]*3+j];
+                if (w != c.v0) ring0.push_back(w);
+            }
+        }
+        std::sort(ring0.begin(), ring0.end());
+        ring0.erase(std::unique(ring0.begin(), ring0.end()), ring0.end());
+        for (size_t i=0; i<ring0.size(); i++) {
+            heap.push(make_collapse(vertices, quadrics, stamps, c.v0, ring0[i]));
+        }
+    }
+
+    // Keep the faces left
+    size_t n = 0;
+    for (uint32_t f=0; f<face_count; f++) {
+        if (!face_alive[f]) continue;
+        for (int j=0; j<3; j++) faces[n*3+j] = faces[f*3+j];
+        n++;
+    }
+    faces.resize(n*3);
+}
+
+// Face with its vertices sorted
+struct FaceKey {
+    uint32_t v[3];      // sorted vertices
+    int sign;           // +1 if the face is an even permutation of v
+    uint32_t face;
+    bool operator<(const FaceKey &other) const {
+        for (int j=0; j<3; j++) {
+            if (v[j] != other.v[j]) return v[j] < other.v[j];
+        }
+        return face < other.face;
+    }
+};
+
+// Drops degenerate faces; coincident faces cancel in pairs of opposite orientation
+void DecimateSink::remove_duplicates() {
+    std::vector<FaceKey> keys;
+    for (uint32_t f=0; f<faces.size()/3; f++) {
+        const uint32_t *p = &faces[f*3];
+        if (p[0] == p[1] || p[1] == p[2] || p[2] == p[0]) continue;
+        FaceKey key;
+        int m = (p[0] < p[1]) ? ((p[0] < p[2]) ? 0 : 2) : ((p[1] < p[2]) ? 1 : 2);
+        uint32_t a = p[m], b = p[(m+1)%3], c = p[(m+2)%3];
+        key.v[0] = a;
+        key.v[1] = (b < c) ? b : c;
+        key.v[2] = (b < c) ? c : b;
+        key.sign = (b < c) ? 1 : -1;
+        key.face = f;
+        keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> kept;
+    for (size_t i=0; i<keys.size(); ) {
+        size_t j = i;
+        int net = 0;
+        while (j < keys.size() && keys[j].v[0] == keys[i].v[0] && keys[j].v[1] == keys[i].v[1] && keys[j].v[2] == keys[i].v[2]) {
+            net += keys[j].sign;
+            j++;
+        }
+        // Keep one face of the remaining orientation (the first one in mesh order)
+        uint32_t first = 0xffffffff;
+        for (size_t k=i; k<j; k++) {
+            if (net != 0 && keys[k].sign == (net > 0 ? 1 : -1) && keys[k].face < first) first = keys[k].face;
+        }
+        if (first != 0xffffffff) kept.push_back(first);
+        i = j;
+    }
+    std::sort(kept.begin(), kept.end());
+
+    std::vector<uint32_t> result(kept.size() * 3);
+    for (size_t i=0; i<kept.size(); i++) {
+        for (int j=0; j<3; j++) result[i*3+j] = faces[kept[i]*3+j];
+    }
+    faces.swap(result);
+}
+
+// Unit normal of a triangle, returns false for a degenerate triangle
+static bool unit_normal(const TRIANGLE &triangle, XYZ &normal) {
+    double n[3];
+    face_normal(triangle.p[0], triangle.p[1], triangle.p[2], n);
+    double length = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+    if (length == 0) return false;
+    normal.x = (float)(n[0] / length);
+    normal.y = (float)(n[1] / length);
+    normal.z = (float)(n[2] / length);
+    return true;
+}
+
+// Feeds a triangle to the sinks
+void DecimateSink::emit(const XYZ &normal, const TRIANGLE &triangle) {
+    for (int k=0; k<sink_count; k++) {
+        if (!sinks[k]->add(normal, triangle)) {
+            // Drop the failed sink, the others continue
+            sinks[k--] = sinks[--sink_count];
+            ok = false;
+        }
+    }
+    output_count++;
+}
+
+// Simplifies the triangles kept so far and feeds them to the sinks
+// (over max_triangles, the corners are fed unchanged)
+void DecimateSink::simplify() {
+    TRACE_SCOPE("decimate");
+    if (clustering()) {
+        cluster_means();
+        remove_duplicates();
+    } else if (!passing && input_count > max_triangles) {
+        for (uint32_t i=0; i<corners.size()/3; i++) {
+            TRIANGLE triangle;
+            XYZ normal;
+            for (int j=0; j<3; j++) triangle.p[j] = corners[i*3+j];
+            if (unit_normal(triangle, normal)) emit(normal, triangle);
+        }
+        std::vector<XYZ>().swap(corners);
+        return;
+    } else {
+        index_corners();
+        if (mode == DECIMATE_QUADRIC) collapse();
+        remove_duplicates();
+    }
+
+    for (uint32_t f=0; f<faces.size()/3; f++) {
+        TRIANGLE triangle;
+        XYZ normal;
+        for (int j=0; j<3; j++) triangle.p[j] = vertices[faces[f*3+j]];
+        if (unit_normal(triangle, normal)) emit(normal, triangle);
+    }
+    std::vector<XYZ>().swap(vertices);
+    std::vector<uint32_t>().swap(faces);
+}
+
+// Feeds the rest of the mesh to the sinks and ends them
+bool DecimateSink::end() {
+    if (!passing) simplify();
+    for (int k=0; k<sink_count; k++) {
+        if (!sinks[k]->end()) ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,95 @@
+/*
+** Mesh decimation
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef MESH_DECIMATOR_HPP
+#define MESH_DECIMATOR_HPP
+
+#include <stdint.h>
+#include <vector>
+#include "marchingcubes.hpp"
+#include "mesh_sink.hpp"
+#include "tinypcl.hpp"
+
+// Decimation modes
+#define DECIMATE_CLUSTER    0   // vertex clustering on a grid of error mm cells (clustered as the triangles arrive, for the device)
+#define DECIMATE_QUADRIC    1   // quadric edge collapse down to ratio of the faces or an error of error mm
+
+// Simplifies the mesh between meshing and the exporters.
+//
+// The triangles are kept until end(), simplified and then fed to the sinks, which see a
+// normal begin/add/end pass. DECIMATE_CLUSTER only keeps the sum of the corners in each
+// cell and 3 cell numbers per face that does not collapse; DECIMATE_QUADRIC keeps the
+// corners and merges identical ones into vertices at end(). Faces which become degenerate
+// are dropped, and coincident faces of opposite orientation cancel out.
+//
+// DECIMATE_CLUSTER needs the cells and 12 bytes per kept face whatever the input size.
+// The other modes keep every corner, so after max_triangles the whole mesh is written
+// unchanged (the kept corners, then the rest as it comes) and the memory stays bounded.
+class DecimateSink : public MeshSink {
+public:
+    DecimateSink(MeshSink *sinks[], int sink_count, int mode, float ratio, float error, size_t max_triangles);
+
+    bool begin();
+    bool add(const XYZ &normal, const TRIANGLE &triangle);
+    bool end();
+
+    uint32_t input_triangles() const { return input_count; }
+    uint32_t output_triangles() const { return output_count; }
+    bool passed_through() const { return passing; }
+private:
+    // Corners of a clustering cell
+    typedef struct {
+        int32_t x, y, z;
+        uint32_t count;
+        double sum[3];
+    } ClusterCell;
+
+    MeshSink *sinks[MESH_MAX_SINKS];
+    int sink_count;
+    int mode;
+    float ratio;            // fraction of the faces to keep (quadric)
+    float error;            // cell size or maximum error (mm)
+    size_t max_triangles;
+    std::vector<XYZ> corners;           // 3 per added triangle (DECIMATE_QUADRIC)
+    std::vector<ClusterCell> cells;     // DECIMATE_CLUSTER
+    std::vector<uint32_t> cell_table;   // hash table of the cells (cell number + 1, 0: empty)
+    std::vector<XYZ> vertices;
+    std::vector<uint32_t> faces;        // 3 vertex (or cell) numbers per face
+    uint32_t input_count, output_count;
+    bool passing;           // over max_triangles, the mesh goes to the sinks unchanged
+    bool ok;
+
+    bool clustering() const { return mode == DECIMATE_CLUSTER && error > 0; }
+    uint32_t cluster_corner(const XYZ &p);
+    void cluster_means();
+    void index_corners();
+    void collapse();
+    void remove_duplicates();
+    void simplify();
+    void emit(const XYZ &normal, const TRIANGLE &triangle);
+};
+
+#endif
@@ -0,0 +1,175 @@
+/*
+** Mesh sinks (writers fed by one marching cubes pass)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <math.h>
+#include "mesh_sink.hpp"
+
+// Constructor: Opens the file
+FileSink::FileSink(const char *file_name, const char *mode) : count(0) {
+    fp = fopen(file_name, mode);
+}
+
+FileSink::~FileSink() {
+    if (fp) fclose(fp);
+}
+
+// Closes the file, returns false if it could not be written
+bool FileSink::close() {
+    if (fp == NULL) return false;
+    bool ok = !ferror(fp);
+    ok = (fclose(fp) == 0) && ok;
+    fp = NULL;
+    return ok;
+}
+
+bool StlSink::begin() {
+    if (fp == NULL) return false;
+
+    uint8_t header[80] = {0};
+    count = 0;
+    fwrite(header, sizeof(header), 1, fp);
+    fwrite(&count, sizeof(uint32_t), 1, fp);
+    return !ferror(fp);
+}
+
+bool StlSink::add(const XYZ &normal, const TRIANGLE &triangle) {
+    uint16_t stub = 0;
+
+    // write Normal vector and Vertex
+    fwrite(&normal, sizeof(XYZ), 1, fp);
+    fwrite(triangle.p, sizeof(XYZ), 3, fp);
+
+    // write unused area
+    fwrite(&stub, sizeof(uint16_t), 1, fp);
+    count++;
+    // A full or removed card drops the sink from the pass
+    return !ferror(fp);
+}
+
+bool StlSink::end() {
+    // Write number of triangles
+    fseek(fp, 80, SEEK_SET);
+    fwrite(&count, sizeof(uint32_t), 1, fp);
+    return close();
+}
+
+bool PlySink::begin() {
+    if (fp == NULL) return false;
+
+    count = 0;
+    fprintf(fp, "ply\n");
+    fprintf(fp, "format binary_little_endian 1.0\n");
+    header_offset = ftell(fp);
+    write_counts();
+    fprintf(fp, "property list uint8 int32 vertex_indices\n");
+    fprintf(fp, "end_header\n");
+    return !ferror(fp);
+}
+
+// Writes the element lines (fixed width, so end() can rewrite them in place)
+void PlySink::write_counts() {
+    fprintf(fp, "element vertex %010lu\n", (unsigned long)count * 3);
+    fprintf(fp, "property float x\n");
+    fprintf(fp, "property float y\n");
+    fprintf(fp, "property float z\n");
+    fprintf(fp, "element face %010lu\n", (unsigned long)count);
+}
+
+bool PlySink::add(const XYZ &normal, const TRIANGLE &triangle) {
+    fwrite(triangle.p, sizeof(XYZ), 3, fp);
+    count++;
+    return !ferror(fp);
+}
+
+bool PlySink::end() {
+    // Faces (each triangle has its own 3 vertices)
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t n = 3;
+        int32_t idx[3] = { (int32_t)(i * 3), (int32_t)(i * 3 + 1), (int32_t)(i * 3 + 2) };
+        fwrite(&n, 1, 1, fp);
+        fwrite(idx, sizeof(idx), 1, fp);
+    }
+
+    fseek(fp, header_offset, SEEK_SET);
+    write_counts();
+    return close();
+}
+
+bool ObjSink::add(const XYZ &normal, const TRIANGLE &triangle) {
+    for (int j = 0; j < 3; j++) {
+        fprintf(fp, "v %g %g %g\n", triangle.p[j].x, triangle.p[j].y, triangle.p[j].z);
+    }
+    fprintf(fp, "f -3 -2 -1\n");
+    count++;
+    return !ferror(fp);
+}
+
+bool MemorySink::begin() {
+    triangles.clear();
+    normals.clear();
+    return true;
+}
+
+bool MemorySink::add(const XYZ &normal, const TRIANGLE &triangle) {
+    if (triangles.size() >= max_triangles) return false;
+    triangles.push_back(triangle);
+    normals.push_back(normal);
+    return true;
+}
+
+bool StatsSink::begin() {
+    triangles = 0;
+    area = volume = 0;
+    min.x = min.y = min.z = 1e30f;
+    max.x = max.y = max.z = -1e30f;
+    return true;
+}
+
+bool StatsSink::add(const XYZ &normal, const TRIANGLE &triangle) {
+    const XYZ &a = triangle.p[0], &b = triangle.p[1], &c = triangle.p[2];
+
+    // Cross product of the edges: twice the area
+    double cx = (b.y - a.y) * (c.z - a.z) - (b.z - a.z) * (c.y - a.y);
+    double cy = (b.z - a.z) * (c.x - a.x) - (b.x - a.x) * (c.z - a.z);
+    double cz = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    area += sqrt(cx * cx + cy * cy + cz * cz) / 2;
+
+    // Signed volume of the tetrahedron with the origin
+    volume += (a.x * (b.y * c.z - b.z * c.y) - a.y * (b.x * c.z - b.z * c.x) + a.z * (b.x * c.y - b.y * c.x)) / 6;
+
+    for (int j = 0; j < 3; j++) {
+        const XYZ &p = triangle.p[j];
+        if (p.x < min.x) min.x = p.x;
+        if (p.y < min.y) min.y = p.y;
+        if (p.z < min.z) min.z = p.z;
+        if (p.x > max.x) max.x = p.x;
+        if (p.y > max.y) max.y = p.y;
+        if (p.z > max.z) max.z = p.z;
+    }
+    triangles++;
+    return true;
+}
@@ -0,0 +1,136 @@
+/*
+** Mesh sinks (writers fed by one marching cubes pass)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef MESH_SINK_HPP
+#define MESH_SINK_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include "marchingcubes.hpp"
+#include "mesh_stream.hpp"
+
+// Receives the triangles of a mesh (vertices in mm, unit normal).
+// PointCloud::generate_mesh() feeds any number of sinks from a single pass; a sink
+// that returns false is dropped from the pass and the others continue.
+class MeshSink {
+public:
+    virtual ~MeshSink() {}
+
+    virtual bool begin() { return true; }
+    virtual bool add(const XYZ &normal, const TRIANGLE &triangle) = 0;
+    virtual bool end() { return true; }
+    virtual void flush() {}
+};
+
+// Base of the sinks writing a file
+class FileSink : public MeshSink {
+public:
+    FileSink(const char *file_name, const char *mode);
+    virtual ~FileSink();
+
+    bool begin() { return fp != NULL; }
+    void flush() { if (fp) fflush(fp); }
+protected:
+    FILE *fp;
+    uint32_t count;     // triangles written
+    bool close();
+};
+
+// Binary STL (the triangle count is written by end())
+class StlSink : public FileSink {
+public:
+    StlSink(const char *file_name) : FileSink(file_name, "wb") {}
+
+    bool begin();
+    bool add(const XYZ &normal, const TRIANGLE &triangle);
+    bool end();
+};
+
+// Binary little endian PLY (vertex and face counts are written by end())
+class PlySink : public FileSink {
+public:
+    PlySink(const char *file_name) : FileSink(file_name, "wb") {}
+
+    bool begin();
+    bool add(const XYZ &normal, const TRIANGLE &triangle);
+    bool end();
+private:
+    long header_offset;     // position of the fixed width counts
+    void write_counts();
+};
+
+// Wavefront OBJ (each triangle is written as 3 vertices and a face)
+class ObjSink : public FileSink {
+public:
+    ObjSink(const char *file_name) : FileSink(file_name, "w") {}
+
+    bool add(const XYZ &normal, const TRIANGLE &triangle);
+    bool end() { return close(); }
+};
+
+// Keeps the mesh in memory (up to max_triangles)
+class MemorySink : public MeshSink {
+public:
+    MemorySink(size_t max_triangles) : max_triangles(max_triangles) {}
+
+    bool begin();
+    bool add(const XYZ &normal, const TRIANGLE &triangle);
+
+    std::vector<TRIANGLE> triangles;
+    std::vector<XYZ> normals;
+private:
+    size_t max_triangles;
+};
+
+// Counts triangles and measures the mesh
+class StatsSink : public MeshSink {
+public:
+    StatsSink() { begin(); }
+
+    bool begin();
+    bool add(const XYZ &normal, const TRIANGLE &triangle);
+
+    uint32_t triangles;
+    double area;        // mm^2
+    double volume;      // mm^3 (signed, positive for a closed outward facing mesh)
+    XYZ min, max;       // bounding box
+};
+
+// Sends the mesh over a MeshStream
+class StreamSink : public MeshSink {
+public:
+    StreamSink(MeshStream &stream, uint32_t index) : stream(stream), index(index) {}
+
+    bool begin() { return stream.begin(index); }
+    bool add(const XYZ &normal, const TRIANGLE &triangle) { return stream.add(normal, triangle); }
+    bool end() { return stream.end(); }
+private:
+    MeshStream &stream;
+    uint32_t index;
+};
+
+#endif
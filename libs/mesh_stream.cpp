@@ -0,0 +1,337 @@
+/*
+** Mesh streaming over a serial link
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <string.h>
+#include "mesh_stream.hpp"
+#include "trace.hpp"
+
+#ifndef __MBED__
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// CRC-16 (CCITT, initial value 0xFFFF)
+static uint16_t crc16(uint16_t crc, uint8_t byte) {
+    crc ^= (uint16_t)byte << 8;
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+static void put_u32(uint8_t *p, uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static uint8_t* put_float(uint8_t *p, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put_u32(p, bits);
+    return p + 4;
+}
+
+#ifdef __MBED__
+// Constructor: Opens the serial port
+SerialStreamPort::SerialStreamPort(PinName tx, PinName rx, int baud, Mutex *lock) : serial(tx, rx, baud), lock(lock) {
+}
+
+bool SerialStreamPort::write(const uint8_t *data, size_t size) {
+    if (lock) lock->lock();
+    for (size_t i = 0; i < size; i++) {
+        serial.putc(data[i]);
+    }
+    if (lock) lock->unlock();
+    return true;
+}
+
+int SerialStreamPort::read(uint8_t *data, size_t size, int timeout_ms) {
+    Timer timer;
+    timer.start();
+    size_t n = 0;
+    while (n == 0 && timer.read_ms() < timeout_ms) {
+        // Let the other threads (and the idle sleep) run while nothing has arrived
+        if (!serial.readable()) {
+            Thread::wait(1);
+            continue;
+        }
+        while (n < size && serial.readable()) {
+            data[n++] = serial.getc();
+        }
+    }
+    return (int)n;
+}
+#else
+bool FdStreamPort::write(const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+int FdStreamPort::read(uint8_t *data, size_t size, int timeout_ms) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0) return (errno == EINTR) ? 0 : -1;
+    if (ready == 0) return 0;
+
+    ssize_t n = ::read(fd, data, size);
+    return (n > 0) ? (int)n : -1;
+}
+#endif
+
+// Feeds one byte of the stream
+int FrameParser::feed(uint8_t byte) {
+    int result = parse(byte);
+    if (result != PARSE_ERROR) return result;
+
+    // Parse the dropped frame again from its next magic. A frame complete among its
+    // bytes is returned and the bytes after it are dropped (the sender resends them).
+    size_t size = raw_size;
+    while (size > 1) {
+        size--;
+        memmove(raw, raw + 1, size);
+        state = 0;
+        size_t i;
+        for (i = 0; i < size; i++) {
+            result = parse(raw[i]);     // stores the byte at raw[raw_size] (not past i)
+            if (result == PARSE_FRAME) return PARSE_FRAME;
+            if (result == PARSE_ERROR) break;
+        }
+        if (i == size) break;
+
+        // Dropped again: go on after the magic of this one
+        memmove(raw + raw_size, raw + i + 1, size - i - 1);
+        size = raw_size + size - i - 1;
+    }
+    return PARSE_ERROR;
+}
+
+// Feeds one byte to the frame state machine
+int FrameParser::parse(uint8_t byte) {
+    switch (state) {
+    case 0:     // waiting for the magic
+        if (byte != STREAM_MAGIC0) return PARSE_TEXT;
+        raw[0] = byte;
+        raw_size = 1;
+        state = 1;
+        return PARSE_BUSY;
+    case 1:
+        if (byte == STREAM_MAGIC0) return PARSE_BUSY;
+        raw[raw_size++] = byte;
+        if (byte != STREAM_MAGIC1) {
+            state = 0;
+            return PARSE_TEXT;
+        }
+        header[0] = STREAM_MAGIC0;
+        header[1] = STREAM_MAGIC1;
+        position = 2;
+        crc = 0xFFFF;
+        state = 2;
+        return PARSE_BUSY;
+    case 2:     // header
+        raw[raw_size++] = byte;
+        header[position++] = byte;
+        crc = crc16(crc, byte);
+        if (position < STREAM_HEADER_SIZE) return PARSE_BUSY;
+
+        type = header[2];
+        sequence = header[3];
+        length = header[4] | (header[5] << 8);
+        if (length > STREAM_MAX_PAYLOAD) {
+            state = 0;
+            return PARSE_ERROR;
+        }
+        position = 0;
+        state = (length > 0) ? 3 : 4;
+        return PARSE_BUSY;
+    case 3:     // payload
+        raw[raw_size++] = byte;
+        payload[position++] = byte;
+        crc = crc16(crc, byte);
+        if (position == length) {
+            position = 0;
+            state = 4;
+        }
+        return PARSE_BUSY;
+    default:    // CRC
+        raw[raw_size++] = byte;
+        header[position++] = byte;
+        if (position < STREAM_TRAILER_SIZE) return PARSE_BUSY;
+
+        state = 0;
+        return ((header[0] | (header[1] << 8)) == crc) ? PARSE_FRAME : PARSE_ERROR;
+    }
+}
+
+// Builds a frame into buffer, returns its size
+size_t stream_frame(uint8_t *buffer, uint8_t type, uint8_t sequence, const uint8_t *payload, uint16_t length) {
+    buffer[0] = STREAM_MAGIC0;
+    buffer[1] = STREAM_MAGIC1;
+    buffer[2] = type;
+    buffer[3] = sequence;
+    buffer[4] = length & 0xff;
+    buffer[5] = length >> 8;
+    if (length > 0) memcpy(buffer + STREAM_HEADER_SIZE, payload, length);
+
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 2; i < STREAM_HEADER_SIZE + (size_t)length; i++) {
+        crc = crc16(crc, buffer[i]);
+    }
+    buffer[STREAM_HEADER_SIZE + length] = crc & 0xff;
+    buffer[STREAM_HEADER_SIZE + length + 1] = crc >> 8;
+    return STREAM_HEADER_SIZE + length + STREAM_TRAILER_SIZE;
+}
+
+// Constructor: Initializes MeshStream
+MeshStream::MeshStream(StreamPort &port) : port(port) {
+    next_sequence = acked_sequence = 0;
+    chunk_triangles = 0;
+    count = 0;
+    resend_count = 0;
+    failed = false;
+}
+
+// Starts the stream of a scan
+bool MeshStream::begin(uint32_t index) {
+    next_sequence = acked_sequence = 0;
+    chunk_triangles = 0;
+    count = 0;
+    resend_count = 0;
+    failed = false;
+    parser.reset();
+
+    uint8_t payload[4];
+    put_u32(payload, index);
+    return send(STREAM_BEGIN, payload, sizeof(payload));
+}
+
+// Adds a triangle (sent when the chunk is full)
+bool MeshStream::add(const XYZ &normal, const TRIANGLE &triangle) {
+    if (failed) return false;
+
+    uint8_t *p = chunk + chunk_triangles * STREAM_TRIANGLE_SIZE;
+    p = put_float(p, normal.x);
+    p = put_float(p, normal.y);
+    p = put_float(p, normal.z);
+    for (int j = 0; j < 3; j++) {
+        p = put_float(p, triangle.p[j].x);
+        p = put_float(p, triangle.p[j].y);
+        p = put_float(p, triangle.p[j].z);
+    }
+    count++;
+
+    if (++chunk_triangles == STREAM_CHUNK_TRIANGLES) return flush();
+    return true;
+}
+
+// Sends the last chunk and waits until the host has received everything
+bool MeshStream::end() {
+    if (failed || !flush()) return false;
+
+    uint8_t payload[4];
+    put_u32(payload, count);
+    return send(STREAM_END, payload, sizeof(payload)) && wait(0);
+}
+
+// Sends the triangles collected so far
+bool MeshStream::flush() {
+    if (chunk_triangles == 0) return true;
+    uint16_t length = chunk_triangles * STREAM_TRIANGLE_SIZE;
+    chunk_triangles = 0;
+    return send(STREAM_TRIANGLES, chunk, length);
+}
+
+// Sends a frame once the window has room for it
+bool MeshStream::send(uint8_t type, const uint8_t *payload, uint16_t length) {
+    TRACE_SCOPE("stream_send");
+    if (failed || !wait(STREAM_WINDOW - 1)) return false;
+
+    int slot = next_sequence % STREAM_WINDOW;
+    frame_sizes[slot] = stream_frame(frames[slot], type, next_sequence, payload, length);
+    next_sequence++;
+    if (!port.write(frames[slot], frame_sizes[slot])) failed = true;
+    return !failed;
+}
+
+// Resends all frames in flight
+bool MeshStream::resend() {
+    for (uint8_t sequence = acked_sequence; sequence != next_sequence; sequence++) {
+        int slot = sequence % STREAM_WINDOW;
+        if (!port.write(frames[slot], frame_sizes[slot])) return false;
+        resend_count++;
+    }
+    return true;
+}
+
+// Processes acks until at most in_flight frames are unacked
+bool MeshStream::wait(int in_flight) {
+    int retries = 0;
+    uint8_t buffer[16];
+
+    while ((uint8_t)(next_sequence - acked_sequence) > in_flight) {
+        int n = port.read(buffer, sizeof(buffer), STREAM_TIMEOUT);
+        if (n < 0) {
+            failed = true;
+            return false;
+        }
+        if (n == 0) {
+            // No answer: resend everything in flight
+            if (++retries > STREAM_RETRIES || !resend()) {
+                failed = true;
+                return false;
+            }
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (parser.feed(buffer[i]) != PARSE_FRAME) continue;
+
+            // Distance of the frame from the oldest one in flight
+            uint8_t offset = parser.sequence - acked_sequence;
+            uint8_t sent = next_sequence - acked_sequence;
+            if (parser.type == STREAM_ACK && offset < sent) {
+                acked_sequence = parser.sequence + 1;
+                retries = 0;
+            } else if (parser.type == STREAM_NAK && offset <= sent) {
+                acked_sequence = parser.sequence;
+                if (!resend()) {
+                    failed = true;
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,171 @@
+/*
+** Mesh streaming over a serial link
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef MESH_STREAM_HPP
+#define MESH_STREAM_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include "marchingcubes.hpp"
+
+#ifdef __MBED__
+#include "mbed.h"
+#endif
+
+// Frame: magic (2), type (1), sequence (1), payload length (2), payload, CRC-16 (2)
+// Multi-byte fields are little endian. The CRC (CCITT) covers everything after the magic.
+#define STREAM_MAGIC0           0xA5
+#define STREAM_MAGIC1           0x5A
+#define STREAM_HEADER_SIZE      6
+#define STREAM_TRAILER_SIZE     2
+#define STREAM_MAX_PAYLOAD      1008
+#define STREAM_MAX_FRAME        (STREAM_HEADER_SIZE + STREAM_MAX_PAYLOAD + STREAM_TRAILER_SIZE)
+
+// Frame types (device to host)
+#define STREAM_BEGIN            0x01    // payload: uint32 scan index
+#define STREAM_TRIANGLES        0x02    // payload: triangles (normal and 3 vertices, 12 floats each)
+#define STREAM_END              0x03    // payload: uint32 number of triangles
+
+// Frame types (host to device)
+#define STREAM_ACK              0x81    // sequence: last frame received in order
+#define STREAM_NAK              0x82    // sequence: next frame expected (resend from there)
+
+// Flow control
+#define STREAM_TRIANGLE_SIZE    48
+#define STREAM_CHUNK_TRIANGLES  (STREAM_MAX_PAYLOAD / STREAM_TRIANGLE_SIZE)
+#define STREAM_WINDOW           4       // frames sent before waiting for an ack
+#define STREAM_TIMEOUT          1000    // ms without an ack before resending
+#define STREAM_RETRIES          3       // resends before giving up
+
+// Byte transport of a stream
+class StreamPort {
+public:
+    virtual ~StreamPort() {}
+
+    // Writes all bytes, returns false on error
+    virtual bool write(const uint8_t *data, size_t size) = 0;
+    // Reads up to size bytes, returns the number of bytes read (0 on timeout, -1 on error)
+    virtual int read(uint8_t *data, size_t size, int timeout_ms) = 0;
+};
+
+#ifdef __MBED__
+// Serial port (the mbed interface USB serial with USBTX/USBRX).
+// On the console UART, pass the mutex the console output holds: each frame is
+// written under it, so no console text lands inside a frame.
+class SerialStreamPort : public StreamPort {
+public:
+    SerialStreamPort(PinName tx, PinName rx, int baud, Mutex *lock = NULL);
+
+    bool write(const uint8_t *data, size_t size);
+    int read(uint8_t *data, size_t size, int timeout_ms);
+private:
+    RawSerial serial;
+    Mutex *lock;
+};
+#else
+// File descriptor (socket or tty) on the host
+class FdStreamPort : public StreamPort {
+public:
+    FdStreamPort(int fd) : fd(fd) {}
+
+    bool write(const uint8_t *data, size_t size);
+    int read(uint8_t *data, size_t size, int timeout_ms);
+private:
+    int fd;
+};
+#endif
+
+// Result of FrameParser::feed
+#define PARSE_BUSY      0   // byte belongs to a frame that is not complete yet
+#define PARSE_FRAME     1   // a valid frame is complete
+#define PARSE_ERROR     2   // a frame was dropped (CRC or length error)
+#define PARSE_TEXT      3   // byte is not part of a frame (console output)
+
+// Splits a byte stream into frames.
+// The bytes of a dropped frame are parsed again from the next magic among them, so a
+// frame that started inside it (e.g. after a corrupted length) is still found.
+class FrameParser {
+public:
+    FrameParser() { reset(); }
+
+    void reset() { state = 0; }
+    int feed(uint8_t byte);
+
+    // Last complete frame
+    uint8_t type;
+    uint8_t sequence;
+    uint16_t length;
+    uint8_t payload[STREAM_MAX_PAYLOAD];
+private:
+    int state;
+    uint16_t position;
+    uint8_t header[STREAM_HEADER_SIZE];
+    uint16_t crc;
+    uint8_t raw[STREAM_MAX_FRAME];  // bytes of the frame being parsed, from its magic
+    uint16_t raw_size;
+
+    int parse(uint8_t byte);
+};
+
+// Builds a frame into buffer (STREAM_MAX_FRAME bytes), returns its size
+size_t stream_frame(uint8_t *buffer, uint8_t type, uint8_t sequence, const uint8_t *payload, uint16_t length);
+
+// Sends triangles in frames as the mesher produces them.
+// Up to STREAM_WINDOW frames are in flight; the host acks frames in order and
+// the stream resends from the oldest unacked frame on a NAK or timeout.
+class MeshStream {
+public:
+    MeshStream(StreamPort &port);
+
+    bool begin(uint32_t index);
+    bool add(const XYZ &normal, const TRIANGLE &triangle);
+    bool end();
+
+    bool ok() const { return !failed; }
+    uint32_t triangles() const { return count; }
+    uint32_t resends() const { return resend_count; }
+private:
+    StreamPort &port;
+    FrameParser parser;
+
+    uint8_t frames[STREAM_WINDOW][STREAM_MAX_FRAME];    // frames in flight (by sequence)
+    size_t frame_sizes[STREAM_WINDOW];
+    uint8_t next_sequence;      // sequence of the next frame
+    uint8_t acked_sequence;     // oldest frame not acked yet
+
+    uint8_t chunk[STREAM_MAX_PAYLOAD];
+    int chunk_triangles;
+    uint32_t count;
+    uint32_t resend_count;
+    bool failed;
+
+    bool send(uint8_t type, const uint8_t *payload, uint16_t length);
+    bool flush();
+    bool wait(int in_flight);
+    bool resend();
+};
+
+#endif
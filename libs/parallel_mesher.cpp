@@ -0,0 +1,131 @@
+/*
+** Slab-parallel marching cubes (host builds)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "parallel_mesher.hpp"
+#include "trace.hpp"
+
+// Slabs per thread (smaller slabs balance the load, the surface is not uniform in z)
+#define MESH_SLABS_PER_THREAD   4
+
+// Meshed triangles of a slab
+struct Slab {
+    int z0, z1;
+    MemorySink triangles;
+    bool done;
+    bool ok;
+
+    Slab() : triangles((size_t)-1), done(false), ok(true) {}
+};
+
+bool generate_mesh_parallel(const PointCloud &point_cloud, MeshSink *sinks[], int sink_count, int threads, int method) {
+    TRACE_SCOPE("generate_mesh_parallel");
+#if GEOMETRY_VALIDATE
+    // The validation records into the global geometry_error
+    threads = 1;
+#endif
+    if (threads < 1) threads = 1;
+
+    // Slabs of cubes, in z order
+    const int cubes = PointCloud::SIZE - 1;
+    int slab_count = threads * MESH_SLABS_PER_THREAD;
+    if (slab_count > cubes) slab_count = cubes;
+    int slab_size = (cubes + slab_count - 1) / slab_count;
+    std::vector<std::unique_ptr<Slab> > slabs;
+    for (int z = 0; z < cubes; z += slab_size) {
+        slabs.emplace_back(new Slab());
+        slabs.back()->z0 = z;
+        slabs.back()->z1 = (z + slab_size < cubes) ? z + slab_size : cubes;
+    }
+
+    std::mutex lock;
+    std::condition_variable completed;
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        int i;
+        while ((i = next++) < (int)slabs.size()) {
+            Slab &slab = *slabs[i];
+            bool ok = point_cloud.mesh_slab(slab.z0, slab.z1, &slab.triangles, method);
+            std::lock_guard<std::mutex> guard(lock);
+            slab.ok = ok;
+            slab.done = true;
+            completed.notify_all();
+        }
+    };
+    // threads workers mesh while the calling thread waits in the ordered merge
+    std::vector<std::thread> pool;
+    if (threads > 1) {
+        for (int i = 0; i < threads; i++) pool.push_back(std::thread(worker));
+    } else {
+        worker();
+    }
+
+    // Sinks still accepting triangles (as generate_mesh)
+    MeshSink *active[MESH_MAX_SINKS];
+    int active_count = 0;
+    bool ok = true;
+    for (int k = 0; k < sink_count && k < MESH_MAX_SINKS; k++) {
+        if (sinks[k]->begin()) {
+            active[active_count++] = sinks[k];
+        } else {
+            ok = false;
+        }
+    }
+
+    // Ordered merge: feed each slab once it is complete, then release it
+    for (size_t s = 0; s < slabs.size(); s++) {
+        Slab &slab = *slabs[s];
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            completed.wait(guard, [&]() { return slab.done; });
+        }
+        if (!slab.ok) ok = false;
+        const std::vector<TRIANGLE> &triangles = slab.triangles.triangles;
+        const std::vector<XYZ> &normals = slab.triangles.normals;
+        for (size_t i = 0; i < triangles.size(); i++) {
+            for (int k = 0; k < active_count; k++) {
+                if (!active[k]->add(normals[i], triangles[i])) {
+                    // Drop the failed sink, the others continue
+                    active[k--] = active[--active_count];
+                    ok = false;
+                }
+            }
+        }
+        slabs[s].reset();
+    }
+
+    for (size_t i = 0; i < pool.size(); i++) pool[i].join();
+    for (int k = 0; k < active_count; k++) {
+        if (!active[k]->end()) ok = false;
+    }
+    return ok;
+}
@@ -0,0 +1,45 @@
+/*
+** Slab-parallel marching cubes (host builds)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef PARALLEL_MESHER_HPP
+#define PARALLEL_MESHER_HPP
+
+#include "tinypcl.hpp"
+#include "mesh_sink.hpp"
+
+// Host tools only (C++11 threads, listed in .mbedignore).
+//
+// Splits the cubes into slabs along z (a slab of cubes z0..z1-1 reads the voxel
+// slices z0..z1, so neighbouring slabs share one slice) and meshes them on threads
+// worker threads into per-slab buffers. The calling thread feeds the buffers to the
+// sinks in slab order as soon as they are complete, so the sinks receive exactly
+// the triangles of PointCloud::generate_mesh() in the same order and vertex sharing
+// in a sink (PLY) is unchanged. With threads = 1 or GEOMETRY_VALIDATE the slabs are
+// meshed on the calling thread.
+bool generate_mesh_parallel(const PointCloud &point_cloud, MeshSink *sinks[], int sink_count, int threads,
+                            int method = MESH_MARCHING_CUBES);
+
+#endif
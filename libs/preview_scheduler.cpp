@@ -0,0 +1,104 @@
+/*
+** Rate limiting of the preview images sent to PC
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <stdlib.h>
+#include "preview_scheduler.hpp"
+#include "trace.hpp"
+
+// Constructor: Initializes PreviewScheduler for YCbCr422 (YUY2) frames of width x height
+PreviewScheduler::PreviewScheduler(int width, int height, float idle_fps, float scan_fps, uint32_t keepalive_ms)
+    : keepalive_ms(keepalive_ms), current_mode(PREVIEW_IDLE), force(true), due_ms(0), last_sent_ms(0),
+      sent_count(0), skipped_count(0) {
+    columns = (width + PREVIEW_DIFF_STEP - 1) / PREVIEW_DIFF_STEP;
+    rows = (height + PREVIEW_DIFF_STEP - 1) / PREVIEW_DIFF_STEP;
+    samples = new uint8_t[columns * rows];
+    intervals[PREVIEW_IDLE] = idle_fps > 0 ? (uint32_t)(1000 / idle_fps) : 0;
+    intervals[PREVIEW_SCAN] = scan_fps > 0 ? (uint32_t)(1000 / scan_fps) : 0;
+}
+
+PreviewScheduler::~PreviewScheduler() {
+    delete[] samples;
+}
+
+// Changes the mode, the next frame is sent as soon as the new mode allows
+void PreviewScheduler::set_mode(int mode) {
+    if (mode == current_mode) return;
+    current_mode = mode;
+    force = true;
+}
+
+// Returns true when a preview of the frame should be sent now.
+// yuv is the current frame (stride bytes per row), now_ms a millisecond clock.
+bool PreviewScheduler::poll(const uint8_t *yuv, int stride, uint32_t now_ms) {
+    if (current_mode == PREVIEW_PAUSED || intervals[current_mode] == 0) return false;
+    if (!force && (int32_t)(now_ms - due_ms) < 0) return false;
+    due_ms = now_ms + intervals[current_mode];
+
+    if (!force && now_ms - last_sent_ms < keepalive_ms && !changed(yuv, stride)) {
+        skipped_count++;
+        return false;
+    }
+    keep(yuv, stride);
+    force = false;
+    last_sent_ms = now_ms;
+    sent_count++;
+    return true;
+}
+
+// Returns the time until the next frame is due (ms)
+uint32_t PreviewScheduler::wait_ms(uint32_t now_ms) const {
+    if (current_mode == PREVIEW_PAUSED || intervals[current_mode] == 0) return keepalive_ms;
+    if (force) return 0;
+    int32_t remaining = (int32_t)(due_ms - now_ms);
+    return remaining > 0 ? (uint32_t)remaining : 0;
+}
+
+// Compares a grid of luma samples with the last sent frame (slow drift adds up
+// until it is sent, as the samples are only replaced by keep())
+bool PreviewScheduler::changed(const uint8_t *yuv, int stride) const {
+    TRACE_SCOPE("preview_diff");
+    int count = 0;
+    for (int r = 0; r < rows; r++) {
+        const uint8_t *row = yuv + r * PREVIEW_DIFF_STEP * stride;
+        const uint8_t *sample = samples + r * columns;
+        for (int c = 0; c < columns; c++) {
+            // YUY2: the luma of pixel x is byte 2x
+            if (abs(row[c * PREVIEW_DIFF_STEP * 2] - sample[c]) > PREVIEW_DIFF_LEVEL) {
+                if (++count >= PREVIEW_DIFF_SAMPLES) return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Keeps the luma samples of the frame being sent
+void PreviewScheduler::keep(const uint8_t *yuv, int stride) {
+    for (int r = 0; r < rows; r++) {
+        const uint8_t *row = yuv + r * PREVIEW_DIFF_STEP * stride;
+        for (int c = 0; c < columns; c++) samples[r * columns + c] = row[c * PREVIEW_DIFF_STEP * 2];
+    }
+}
@@ -0,0 +1,74 @@
+/*
+** Rate limiting of the preview images sent to PC
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef PREVIEW_SCHEDULER_HPP
+#define PREVIEW_SCHEDULER_HPP
+
+#include <stdint.h>
+
+// Preview modes
+#define PREVIEW_IDLE    0   // no scan running
+#define PREVIEW_SCAN    1   // scanning (previews compete with carving)
+#define PREVIEW_PAUSED  2   // meshing and writing, nothing is sent
+
+// Frame diff parameters
+#define PREVIEW_DIFF_STEP       16  // sampling step of the luma in both directions (pixels)
+#define PREVIEW_DIFF_LEVEL      12  // luma difference of a changed sample (above the sensor noise)
+#define PREVIEW_DIFF_SAMPLES    4   // changed samples that make a changed frame
+
+// Decides when the next preview image is sent.
+//
+// Each mode has its own frame rate (0: none). When a frame is due, a sub-sampled luma
+// diff against the last sent frame skips it if nothing moved, unless the viewer has not
+// had a frame for keepalive_ms. Changing the mode makes the next frame due at once.
+class PreviewScheduler {
+public:
+    PreviewScheduler(int width, int height, float idle_fps, float scan_fps, uint32_t keepalive_ms);
+    ~PreviewScheduler();
+
+    void set_mode(int mode);
+    int mode() const { return current_mode; }
+
+    bool poll(const uint8_t *yuv, int stride, uint32_t now_ms);
+    uint32_t wait_ms(uint32_t now_ms) const;
+
+    uint32_t sent() const { return sent_count; }
+    uint32_t skipped() const { return skipped_count; }
+private:
+    int columns, rows;          // luma samples of a frame
+    uint32_t intervals[2];      // ms between frames of each mode (0: no frames)
+    uint32_t keepalive_ms;
+    int current_mode;
+    bool force;                 // send the next due frame even if unchanged
+    uint32_t due_ms, last_sent_ms;
+    uint8_t *samples;           // luma samples of the last sent frame
+    uint32_t sent_count, skipped_count;
+
+    bool changed(const uint8_t *yuv, int stride) const;
+    void keep(const uint8_t *yuv, int stride);
+};
+
+#endif
@@ -0,0 +1,413 @@
+/*
+** 3D reconstruction (Shape from silhouette)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <math.h>
+#include "reconstruction.hpp"
+#include "carve_kernel.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+
+// Levels of interleaved_view (views at multiples of 2^INTERLEAVE_LEVELS come first)
+#define INTERLEAVE_LEVELS 3
+
+// Constructor: Initializes ConvergenceMonitor
+ConvergenceMonitor::ConvergenceMonitor(int views, double fraction, int min_views)
+    : views(views), fraction(fraction), min_views(min_views) {
+    clear();
+}
+
+// Forgets all views (call before each scan)
+void ConvergenceMonitor::clear() {
+    quiet = 0;
+    count = 0;
+}
+
+// Adds the statistics of a view, returns true when the scan has converged
+bool ConvergenceMonitor::update(const CarveStats &stats) {
+    count++;
+    if (stats.removed + stats.outside < fraction * stats.tested) {
+        quiet++;
+    } else {
+        quiet = 0;
+    }
+    return converged();
+}
+
+// Returns the turntable angle (rad) of the view
+double view_angle(int view, int view_counts) {
+    return (double)(2 * 3.14159265258979)*((double)view / view_counts);
+}
+
+// Returns the turntable angle (rad) of a position between two steps (same scale as view_angle)
+double position_angle(double position, int positions) {
+    return (double)(2 * 3.14159265258979)*(position / positions);
+}
+
+// Returns the view to take at the i-th capture, coarse to fine
+int interleaved_view(int i, int view_counts) {
+    for (int level = INTERLEAVE_LEVELS; level >= 0; level--) {
+        for (int view = 0; view < view_counts; view++) {
+            // Number of trailing zero bits, capped at INTERLEAVE_LEVELS
+            int zeros = 0;
+            while (zeros < INTERLEAVE_LEVELS && ((view >> zeros) & 1) == 0) zeros++;
+
+            if (zeros == level && i-- == 0) return view;
+        }
+    }
+    return -1;
+}
+
+// Projects a 3D point into camera coordinates
+int projection(const CameraModel &camera, double rad, double Xw, double Yw, double Zw, int &u, int &v)
+{
+    return Projector<double>(camera, rad).project(Xw, Yw, Zw, u, v);
+}
+
+// Projects the corners of the box [bx0,bx1] x [by0,by1] x [bz0,bz1] and returns the bounding
+// rectangle of the (continuous) image coordinates, or false if the box reaches the camera plane
+static bool project_box(const CameraModel &camera, double c, double s, const double bx[2], const double by[2], const double bz[2],
+                        double &umin, double &umax, double &vmin, double &vmax) {
+    umin = 1e30, umax = -1e30, vmin = 1e30, vmax = -1e30;
+    for (int i = 0; i < 8; i++) {
+        double X = bx[i & 1], Y = by[(i >> 1) & 1], Z = bz[i >> 2];
+        double Xc = c*X + s*Y;
+        double Yc =-s*X + c*Y - camera.distance;
+        double Zc = Z + camera.offset;
+        if (Yc > -1.0) return false;    // Too close to the camera plane
+
+        double u = camera.center_u - (Xc/Yc)*camera.fx;
+        double v = camera.height - camera.center_v + (Zc/Yc)*camera.fy;
+        if (u < umin) umin = u;
+        if (u > umax) umax = u;
+        if (v < vmin) vmin = v;
+        if (v > vmax) vmax = v;
+    }
+    return true;
+}
+
+// Returns the image rectangle that contains the projection of every voxel of the grid
+cv::Rect grid_roi(const CameraModel &camera, double rad) {
+    // Bounding box of the voxels (including their footprint)
+    const double origin = (-PointCloud::SIZE / 2) * PointCloud::SCALE;
+    const double half = PointCloud::SCALE / 2;
+    double b[2] = { origin - half, origin + (PointCloud::SIZE - 1) * PointCloud::SCALE + half };
+
+    double umin, umax, vmin, vmax;
+    if (!project_box(camera, cos(rad), sin(rad), b, b, b, umin, umax, vmin, vmax)) {
+        return Rect(0, 0, camera.width, camera.height);
+    }
+
+    // projection() truncates toward zero, so a point lands on the floor or the ceiling of
+    // its continuous coordinate. The first row and column of a crop count as outside, so
+    // keep one more pixel before the box.
+    int u0 = (int)floor(umin) - 1, u1 = (int)floor(umax) + 2;
+    int v0 = (int)floor(vmin) - 1, v1 = (int)floor(vmax) + 2;
+    if (u0 < 0) u0 = 0;
+    if (v0 < 0) v0 = 0;
+    if (u1 > camera.width) u1 = camera.width;
+    if (v1 > camera.height) v1 = camera.height;
+    if (u0 >= u1 || v0 >= v1) return Rect(0, 0, 0, 0);
+    return Rect(u0, v0, u1 - u0, v1 - v0);
+}
+
+// Returns the camera model of the image cropped to roi
+CameraModel crop_camera(const CameraModel &camera, const Rect &roi) {
+    // projection(): u = (int)center_u - .., v = height - ((int)center_v - ..)
+    CameraModel crop = camera;
+    crop.center_u = (int)camera.center_u - roi.x;
+    crop.center_v = (int)camera.center_v - (camera.height - roi.y - roi.height);
+    crop.width = roi.width;
+    crop.height = roi.height;
+    return crop;
+}
+
+// Constructor: computes the region of interest of each turntable position
+ViewRoi::ViewRoi(const CameraModel &camera, int positions) : max(0, 0) {
+    rois = new Rect[positions];
+    for (int i = 0; i < positions; i++) {
+        rois[i] = grid_roi(camera, view_angle(i, positions));
+        if (rois[i].width > max.width) max.width = rois[i].width;
+        if (rois[i].height > max.height) max.height = rois[i].height;
+    }
+}
+
+ViewRoi::~ViewRoi() {
+    delete[] rois;
+}
+
+// Makes a silhouette from a BGR image (non-background pixels are 255)
+void silhouette_from_bgr(const Mat &img_bgr, Mat &img_silhouette) {
+    // Convert color from BGR to HSV
+    Mat img_hsv;
+    cvtColor(img_bgr, img_hsv, COLOR_BGR2HSV);
+
+    // Detect blue color and make a silhouette from blue mask
+    inRange(img_hsv, BACKGROUND_HSV_LOWER, BACKGROUND_HSV_UPPER, img_silhouette);
+    bitwise_not(img_silhouette, img_silhouette);
+}
+
+// Voxel based "Shape from silhouette"
+// Only voxels that lie inside all silhouette volumes remain part of the final shape.
+CarveStats shape_from_silhouette(PointCloud &point_cloud, const Mat &img_silhouette, const CameraModel &camera, double rad) {
+    TRACE_SCOPE("carve");
+    CarveStats stats = { 0, 0, 0 };
+
+#if CARVE_KERNEL_ENABLE
+    // Check runs of voxels along X with the vector kernel
+    CarveKernel kernel;
+    carve_kernel_init(kernel, camera, rad);
+
+    // X coordinates of the voxels (accumulated like the per-voxel loop, padded for the kernel)
+    const float scale = point_cloud.SCALE;
+    float xs[PointCloud::SIZE + CARVE_RUN_MAX];
+    xs[0] = (-point_cloud.SIZE / 2) * point_cloud.SCALE;
+    for (int x=1; x<point_cloud.SIZE + CARVE_RUN_MAX; x++) xs[x] = xs[x-1] + scale;
+
+    float yy, zz;
+    zz = (-point_cloud.SIZE / 2) * point_cloud.SCALE;
+    for (int z=0; z<point_cloud.SIZE; z++, zz += scale) {
+
+        yy = (-point_cloud.SIZE / 2) * point_cloud.SCALE;
+        for (int y=0; y<point_cloud.SIZE; y++, yy += scale) {
+
+            for (int x=0; x<point_cloud.SIZE; x += CARVE_RUN_MAX) {
+                int count = (point_cloud.SIZE - x < CARVE_RUN_MAX) ? (point_cloud.SIZE - x) : CARVE_RUN_MAX;
+                uint32_t alive = point_cloud.get_bits(x, y, z, count);
+                if (alive == 0) continue;
+
+                // Keep the points inside the shilhouette, delete the others
+                uint32_t in_image;
+                uint32_t keep = carve_run(kernel, img_silhouette, xs + x, count, yy, zz, alive, in_image);
+                point_cloud.and_bits(x, y, z, count, keep);
+
+                stats.tested += __builtin_popcount(alive);
+                stats.removed += __builtin_popcount(in_image & ~keep);
+                stats.outside += __builtin_popcount(alive & ~in_image);
+            }
+        }
+    }
+#else
+    // Check each voxels
+    Projector<geom_t> projector(camera, rad);
+    const geom_t scale = geom_t(point_cloud.SCALE);
+    geom_t xx,yy,zz;    // 3D point(x,y,z)
+    int u,v;            // camera coordinates(x,y)
+#if GEOMETRY_VALIDATE
+    Projector<double> reference(camera, rad);
+#endif
+
+    zz = geom_t((-point_cloud.SIZE / 2) * point_cloud.SCALE);
+    for (int z=0; z<point_cloud.SIZE; z++, zz += scale) {
+
+        yy = geom_t((-point_cloud.SIZE / 2) * point_cloud.SCALE);
+        for (int y=0; y<point_cloud.SIZE; y++, yy += scale) {
+
+            xx = geom_t((-point_cloud.SIZE / 2) * point_cloud.SCALE);
+            for (int x=0; x<point_cloud.SIZE; x++, xx += scale) {
+                if (point_cloud.get(x, y, z) == 1) {
+                    stats.tested++;
+
+                    // Project a 3D point into camera coordinates
+                    int inside = projector.project(xx, yy, zz, u, v);
+#if GEOMETRY_VALIDATE
+                    int ru, rv;
+                    int reference_inside = reference.project((x + (-point_cloud.SIZE / 2)) * (double)point_cloud.SCALE,
+                                                             (y + (-point_cloud.SIZE / 2)) * (double)point_cloud.SCALE,
+                                                             (z + (-point_cloud.SIZE / 2)) * (double)point_cloud.SCALE, ru, rv);
+                    geometry_error.projections++;
+                    if (inside != reference_inside || (inside && (u != ru || v != rv))) geometry_error.pixel_mismatches++;
+#endif
+                    if (inside) {
+                        if (img_silhouette.at<unsigned char>(v, u)) {
+                            // Keep the point because it is inside the shilhouette
+                        }
+                        else {
+                            // Delete the point because it is outside the shilhouette
+                            point_cloud.set(x, y, z, 0);
+                            stats.removed++;
+                        }
+                    } else {
+                        // Delete the point because it is outside the camera image
+                        point_cloud.set(x, y, z, 0);
+                        stats.outside++;
+                    }
+                }
+            }
+        }
+    }
+#endif
+
+    return stats;
+}
+
+// Builds the summed-area table of a silhouette (modulo 2^16)
+void silhouette_sat(const Mat &img_silhouette, Mat &sat) {
+    TRACE_SCOPE("silhouette_sat");
+
+    int width = img_silhouette.cols;
+    int height = img_silhouette.rows;
+    if (sat.rows != height + 1 || sat.cols != width + 1 || sat.type() != CV_16U) {
+        sat = Mat(height + 1, width + 1, CV_16U);
+    }
+
+    unsigned short *row = sat.ptr<unsigned short>(0);
+    for (int u = 0; u <= width; u++) row[u] = 0;
+
+    for (int v = 0; v < height; v++) {
+        const unsigned char *pixel = img_silhouette.ptr<unsigned char>(v);
+        const unsigned short *prev = sat.ptr<unsigned short>(v);
+        row = sat.ptr<unsigned short>(v + 1);
+
+        unsigned short line = 0;
+        row[0] = 0;
+        for (int u = 0; u < width; u++) {
+            line += (pixel[u] != 0);
+            row[u + 1] = prev[u + 1] + line;
+        }
+    }
+}
+
+// State shared by the blocks of one view
+typedef struct {
+    PointCloud *point_cloud;
+    const Mat *sat;
+    const CameraModel *camera;
+    double c, s;        // cos, sin of the view angle
+    CarveStats stats;
+} SatCarver;
+
+// Footprint classification
+#define FOOTPRINT_OUTSIDE   0
+#define FOOTPRINT_INSIDE    1
+#define FOOTPRINT_PARTIAL   2
+
+// Classifies the image rectangle covered by the voxels [x0,x1) x [y0,y1) x [z0,z1)
+static int classify_footprint(const SatCarver &carver, int x0, int y0, int z0, int x1, int y1, int z1) {
+    const CameraModel &camera = *carver.camera;
+    const double origin = (-PointCloud::SIZE / 2) * PointCloud::SCALE;
+    const double half = PointCloud::SCALE / 2;
+
+    // Bounding box of the voxels (voxel centres are at origin + index * SCALE)
+    double bx[2] = { origin + x0 * PointCloud::SCALE - half, origin + (x1 - 1) * PointCloud::SCALE + half };
+    double by[2] = { origin + y0 * PointCloud::SCALE - half, origin + (y1 - 1) * PointCloud::SCALE + half };
+    double bz[2] = { origin + z0 * PointCloud::SCALE - half, origin + (z1 - 1) * PointCloud::SCALE + half };
+
+    // Project the 8 corners and take their bounding rectangle
+    double umin, umax, vmin, vmax;
+    if (!project_box(camera, carver.c, carver.s, bx, by, bz, umin, umax, vmin, vmax)) return FOOTPRINT_PARTIAL;
+
+    // Pixels [u0,u1) x [v0,v1), clipped to the image
+    // (projection() truncates toward zero, so a point may land on the ceiling
+    // of its continuous coordinate: include one more pixel on the far side)
+    int u0 = (int)floor(umin), u1 = (int)floor(umax) + 2;
+    int v0 = (int)floor(vmin), v1 = (int)floor(vmax) + 2;
+    bool clipped = (u0 < 0 || v0 < 0 || u1 > camera.width || v1 > camera.height);
+    if (u0 < 0) u0 = 0;
+    if (v0 < 0) v0 = 0;
+    if (u1 > camera.width) u1 = camera.width;
+    if (v1 > camera.height) v1 = camera.height;
+    if (u0 >= u1 || v0 >= v1) return FOOTPRINT_OUTSIDE;
+
+    // The 16-bit table is only exact for rectangles below 65536 pixels
+    long area = (long)(u1 - u0) * (v1 - v0);
+    if (area >= 65536) return FOOTPRINT_PARTIAL;
+
+    const unsigned short *r0 = carver.sat->ptr<unsigned short>(v0);
+    const unsigned short *r1 = carver.sat->ptr<unsigned short>(v1);
+    unsigned short sum = (unsigned short)(r1[u1] - r1[u0] - r0[u1] + r0[u0]);
+
+    if (sum == 0) return FOOTPRINT_OUTSIDE;
+    if (sum == area && !clipped) return FOOTPRINT_INSIDE;
+    return FOOTPRINT_PARTIAL;
+}
+
+// Carves the voxels [x0,x0+size) x [y0,y0+size) x [z0,z0+size)
+static void carve_block(SatCarver &carver, int x0, int y0, int z0, int size) {
+    PointCloud &point_cloud = *carver.point_cloud;
+    int x1 = x0 + size, y1 = y0 + size, z1 = z0 + size;
+    if (x1 > PointCloud::SIZE) x1 = PointCloud::SIZE;
+    if (y1 > PointCloud::SIZE) y1 = PointCloud::SIZE;
+    if (z1 > PointCloud::SIZE) z1 = PointCloud::SIZE;
+
+    // Count the remaining voxels (nothing to do for an empty block)
+    int alive = 0;
+    for (int z=z0; z<z1; z++) {
+        for (int y=y0; y<y1; y++) {
+            alive += __builtin_popcount(point_cloud.get_bits(x0, y, z, x1 - x0));
+        }
+    }
+    if (alive == 0) return;
+
+    int footprint = classify_footprint(carver, x0, y0, z0, x1, y1, z1);
+    if (footprint == FOOTPRINT_PARTIAL && size > 1) {
+        // Split into 8 sub-blocks
+        int half = (size + 1) / 2;
+        for (int i = 0; i < 8; i++) {
+            int sx = x0 + (i & 1) * half, sy = y0 + ((i >> 1) & 1) * half, sz = z0 + (i >> 2) * half;
+            if (sx < x1 && sy < y1 && sz < z1) carve_block(carver, sx, sy, sz, half);
+        }
+        return;
+    }
+
+    carver.stats.tested += alive;
+    if (footprint == FOOTPRINT_OUTSIDE) {
+        // Delete the voxels because their footprint is outside the shilhouette
+        for (int z=z0; z<z1; z++) {
+            for (int y=y0; y<y1; y++) {
+                point_cloud.and_bits(x0, y, z, x1 - x0, 0);
+            }
+        }
+        carver.stats.removed += alive;
+    }
+    // Keep the voxels because their footprint is (at least partially) inside the silhouette
+}
+
+// Conservative "Shape from silhouette" with a summed-area table
+CarveStats shape_from_silhouette_sat(PointCloud &point_cloud, const Mat &sat, const CameraModel &camera, double rad) {
+    TRACE_SCOPE("carve");
+
+    SatCarver carver;
+    carver.point_cloud = &point_cloud;
+    carver.sat = &sat;
+    carver.camera = &camera;
+    carver.c = cos(rad);
+    carver.s = sin(rad);
+    carver.stats.tested = 0;
+    carver.stats.removed = 0;
+    carver.stats.outside = 0;
+
+    for (int z=0; z<point_cloud.SIZE; z+=CARVE_BLOCK_SIZE) {
+        for (int y=0; y<point_cloud.SIZE; y+=CARVE_BLOCK_SIZE) {
+            for (int x=0; x<point_cloud.SIZE; x+=CARVE_BLOCK_SIZE) {
+                carve_block(carver, x, y, z, CARVE_BLOCK_SIZE);
+            }
+        }
+    }
+
+    return carver.stats;
+}
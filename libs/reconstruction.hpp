@@ -0,0 +1,171 @@
+/*
+** 3D reconstruction (Shape from silhouette)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef RECONSTRUCTION_HPP
+#define RECONSTRUCTION_HPP
+
+#include <math.h>
+#include "opencv.hpp"
+#include "tinypcl.hpp"
+#include "geometry.hpp"
+
+// Background color range in HSV (blue background is outside the silhouette)
+#define BACKGROUND_HSV_LOWER    cv::Scalar(100, 50, 0)
+#define BACKGROUND_HSV_UPPER    cv::Scalar(140, 255, 255)
+
+// Carving modes
+#define CARVE_CENTER        0   // Project the voxel centre
+#define CARVE_FOOTPRINT     1   // Project the voxel footprint (conservative, see shape_from_silhouette_sat)
+
+// Edge length (voxels) of the blocks tested first in CARVE_FOOTPRINT mode
+#define CARVE_BLOCK_SIZE    8
+
+// Size of the summed-area table of a silhouette (16-bit entries)
+#define SAT_BYTES(width, height) (((width) + 1) * ((height) + 1) * 2)
+
+// Camera model used to project voxels into silhouette images
+typedef struct {
+    double distance;    // Distance from the origin to the camera (mm)
+    double offset;      // Height offset of the camera relative to the origin (mm)
+    double center_u;    // Optical centers (cx)
+    double center_v;    // Optical centers (cy)
+    double fx;          // Focal length(fx)
+    double fy;          // Focal length(fy)
+    int width;          // Image width (pixel)
+    int height;         // Image height (pixel)
+} CameraModel;
+
+// Projects 3D points into the camera image of one view, in the scalar type T
+// (same arithmetic as projection(), with the rotation computed once per view)
+template <typename T>
+class Projector {
+public:
+    Projector() {}
+    Projector(const CameraModel &camera, double rad)
+        : c(T(cos(rad))), s(T(sin(rad))), distance(T(camera.distance)), offset(T(camera.offset)),
+          fx(T(camera.fx)), fy(T(camera.fy)), center_u((int)camera.center_u), center_v((int)camera.center_v),
+          width(camera.width), height(camera.height) {}
+
+    // Returns non-zero if the point is inside the image
+    int project(T Xw, T Yw, T Zw, int &u, int &v) const {
+        // rotate around the Z axis
+        T Xc = c*Xw + s*Yw;
+        T Yc =-s*Xw + c*Yw;
+        T Zc = Zw;
+
+        // Perspective projection
+        Yc -= distance;
+        Zc += offset;
+
+        u = center_u - scalar_trunc(scalar_muldiv(Xc, fx, Yc));
+        v = height - (center_v - scalar_trunc(scalar_muldiv(Zc, fy, Yc)));
+
+        return (u>0 && u<width && v>0 && v<height);
+    }
+private:
+    T c, s;             // cos, sin of the view angle
+    T distance, offset, fx, fy;
+    int center_u, center_v, width, height;
+};
+
+// Per-view statistics of shape_from_silhouette
+typedef struct {
+    int tested;         // Voxels alive before the view
+    int removed;        // Voxels deleted because they are outside the silhouette
+    int outside;        // Voxels deleted because they project outside the image
+} CarveStats;
+
+// Stops a scan once `views` consecutive views each remove less than
+// `fraction` of the remaining voxels (but not before `min_views` views)
+class ConvergenceMonitor {
+public:
+    ConvergenceMonitor(int views, double fraction, int min_views);
+
+    void clear();
+    bool update(const CarveStats &stats);
+    bool converged() const { return quiet >= views && count >= min_views; }
+private:
+    int views;
+    double fraction;
+    int min_views;
+    int quiet;          // Consecutive views below the fraction
+    int count;          // Views seen
+};
+
+// Returns the turntable angle (rad) of the view
+double view_angle(int view, int view_counts);
+
+// Returns the turntable angle (rad) of a position between two steps (continuous rotation)
+double position_angle(double position, int positions);
+
+// Returns the view to take at the i-th capture, coarse to fine (0, 8, 16, .., 4, 12, .., 2, 6, .., 1, 3, ..)
+// Each level is one sweep in the turning direction, so early termination leaves no large gaps
+int interleaved_view(int i, int view_counts);
+
+// Projects a 3D point into camera coordinates
+int projection(const CameraModel &camera, double rad, double Xw, double Yw, double Zw, int &u, int &v);
+
+// Returns the image rectangle that contains the projection of every voxel of the grid
+// at the turntable angle rad (clipped to the image). Pixels outside it can only be
+// treated as background, so the silhouette only needs this region.
+cv::Rect grid_roi(const CameraModel &camera, double rad);
+
+// Returns the camera model of the image cropped to roi: projection() then gives pixel
+// coordinates relative to the roi and rejects points outside it
+CameraModel crop_camera(const CameraModel &camera, const cv::Rect &roi);
+
+// Regions of interest of all turntable positions (computed once)
+class ViewRoi {
+public:
+    ViewRoi(const CameraModel &camera, int positions);
+    ~ViewRoi();
+
+    const cv::Rect& roi(int position) const { return rois[position]; }
+    cv::Size max_size() const { return max; }   // largest width and height of all rois
+private:
+    cv::Rect *rois;
+    cv::Size max;
+};
+
+// Makes a silhouette from a BGR image (non-background pixels are 255)
+void silhouette_from_bgr(const cv::Mat &img_bgr, cv::Mat &img_silhouette);
+
+// Voxel based "Shape from silhouette"
+// Only voxels that lie inside all silhouette volumes remain part of the final shape.
+CarveStats shape_from_silhouette(PointCloud &point_cloud, const cv::Mat &img_silhouette, const CameraModel &camera, double rad);
+
+// Builds the summed-area table of a silhouette into sat ((height+1) x (width+1), CV_16U).
+// Entries are kept modulo 2^16, which is exact for any rectangle smaller than 65536 pixels.
+void silhouette_sat(const cv::Mat &img_silhouette, cv::Mat &sat);
+
+// Conservative "Shape from silhouette"
+// Each block's (then voxel's) bounding box is projected to an image rectangle and
+// classified in O(1) with the summed-area table: blocks fully inside are kept, blocks
+// fully outside are deleted and partial blocks are split. Partial voxels are kept, so
+// features thinner than a voxel survive coarse grids.
+CarveStats shape_from_silhouette_sat(PointCloud &point_cloud, const cv::Mat &sat, const CameraModel &camera, double rad);
+
+#endif
@@ -25,56 +25,512 @@
 ** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
 */
 
-#include <bitset>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
+#include <new>
 #include "tinypcl.hpp"
+#include "trace.hpp"
+
+const float PointCloud::SCALE = PCD_SCALE;
+
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+// Word of a voxel (bricks in linear order, the lower 32 bits of a brick are z = 0,1)
+#define PCD_BRICK_WORD(x,y,z)   ((((((z) >> 2) * PCD_BRICKS) + ((y) >> 2)) * PCD_BRICKS + ((x) >> 2)) * 2 + (((z) >> 1) & 1))
+#endif
+
+// Mask of a range of count bits (count <= 32)
+static inline uint32_t bit_range(int count) {
+    return (count < 32) ? (((uint32_t)1 << count) - 1) : 0xffffffff;
+}
+
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+// Returns the bits of the voxels of a brick inside the grid
+static void brick_mask(unsigned int bx, unsigned int by, unsigned int bz, uint32_t mask[2]) {
+    unsigned int nx = PCD_SIZE - bx * 4, ny = PCD_SIZE - by * 4, nz = PCD_SIZE - bz * 4;
+    if (nx > 4) nx = 4;
+    if (ny > 4) ny = 4;
+    if (nz > 4) nz = 4;
+    mask[0] = mask[1] = 0;
+    for (unsigned int z=0; z<nz; z++) {
+        for (unsigned int y=0; y<ny; y++) {
+            mask[z >> 1] |= bit_range(nx) << (PCD_BRICK_BIT(0, y, z) & 31);
+        }
+    }
+}
+#endif
+
+#if PCD_LAYOUT == PCD_LAYOUT_RUNS
+// Runs of a row
+#define ROW_RUNS(row)   ((row).capacity ? (row).heap : (row).local)
+
+// Appends the run [begin,end) to runs, merging it with the last one if they touch
+static inline void append_run(uint16_t *runs, int &count, unsigned int begin, unsigned int end) {
+    if (begin >= end) return;
+    if (count > 0 && runs[count*2-1] == begin) {
+        runs[count*2-1] = end;
+    } else {
+        runs[count*2] = begin;
+        runs[count*2+1] = end;
+        count++;
+    }
+}
+#endif
 
 // Constructor: Initializes PointCloud
 PointCloud::PointCloud(void) {
+#if PCD_LAYOUT == PCD_LAYOUT_RUNS
+    for (int i=0; i<SIZE*SIZE; i++) {
+        rows[i].count = 0;
+        rows[i].capacity = 0;
+    }
+#endif
     clear();
 }
 
-// Returns the value of the point
-unsigned char PointCloud::get(unsigned int index) {
-    return point_cloud_data[index];
+#if PCD_LAYOUT == PCD_LAYOUT_RUNS
+// Copy constructor: the run lists are copied
+PointCloud::PointCloud(const PointCloud &other) {
+    for (int i=0; i<SIZE*SIZE; i++) {
+        rows[i].count = 0;
+        rows[i].capacity = 0;
+    }
+    *this = other;
+}
+
+// Copies the run lists (a row which cannot be allocated is left full)
+PointCloud &PointCloud::operator=(const PointCloud &other) {
+    if (this == &other) return *this;
+    for (int i=0; i<SIZE*SIZE; i++) {
+        if (!assign_row(rows[i], ROW_RUNS(other.rows[i]), other.rows[i].count)) {
+            uint16_t full[2] = { 0, (uint16_t)SIZE };
+            assign_row(rows[i], full, 1);
+        }
+    }
+    return *this;
+}
+
+// Destructor: frees the run lists
+PointCloud::~PointCloud() {
+    free_rows();
+}
+
+// Frees the run lists allocated in heap
+void PointCloud::free_rows(void) {
+    for (int i=0; i<SIZE*SIZE; i++) {
+        if (rows[i].capacity) delete[] rows[i].heap;
+        rows[i].capacity = 0;
+        rows[i].count = 0;
+    }
+}
+
+// Replaces the runs of a row, returns false (row unchanged) if they cannot be allocated
+bool PointCloud::assign_row(RunRow &row, const uint16_t *runs, int count) {
+    int capacity = row.capacity ? row.capacity : PCD_ROW_LOCAL_RUNS;
+    if (count > capacity) {
+        // Grow by half again to avoid reallocating for every split
+        int grown = count + count / 2;
+        if (grown > (SIZE + 1) / 2) grown = (SIZE + 1) / 2;
+        uint16_t *heap = new (std::nothrow) uint16_t[grown * 2];
+        if (heap == NULL) return false;
+        if (row.capacity) delete[] row.heap;
+        row.heap = heap;
+        row.capacity = grown;
+    }
+    memmove(ROW_RUNS(row), runs, count * 2 * sizeof(uint16_t));
+    row.count = count;
+    return true;
+}
+#endif
+
+// Returns the value of the point (linear index)
+unsigned char PointCloud::get(unsigned int index) const {
+#if PCD_LAYOUT != PCD_LAYOUT_LINEAR
+    return get(index % SIZE, (index / SIZE) % SIZE, index / (SIZE*SIZE));
+#else
+    return (point_cloud_data[index >> 5] >> (index & 31)) & 1;
+#endif
 }
 
 // Returns the value of the point
-unsigned char PointCloud::get(unsigned int x, unsigned int y, unsigned int z) {
-    return point_cloud_data(x,y,z);
+unsigned char PointCloud::get(unsigned int x, unsigned int y, unsigned int z) const {
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    return (point_cloud_data[PCD_BRICK_WORD(x,y,z)] >> (PCD_BRICK_BIT(x,y,z) & 31)) & 1;
+#elif PCD_LAYOUT == PCD_LAYOUT_RUNS
+    const RunRow &row = rows[y + z*SIZE];
+    const uint16_t *runs = ROW_RUNS(row);
+    for (int i=0; i<row.count && runs[i*2] <= x; i++) {
+        if (x < runs[i*2+1]) return 1;
+    }
+    return 0;
+#else
+    return get(PCD_INDEX(x,y,z));
+#endif
 }
 
-// Sets the value of the point
+// Sets the value of the point (linear index)
 void PointCloud::set(unsigned int index, unsigned char val) {
-    point_cloud_data[index] = val;
+#if PCD_LAYOUT != PCD_LAYOUT_LINEAR
+    set(index % SIZE, (index / SIZE) % SIZE, index / (SIZE*SIZE), val);
+#else
+    if (val) {
+        point_cloud_data[index >> 5] |= (uint32_t)1 << (index & 31);
+    } else {
+        point_cloud_data[index >> 5] &= ~((uint32_t)1 << (index & 31));
+    }
+#endif
 }
 
 // Sets the value of the point
 void PointCloud::set(unsigned int x, unsigned int y, unsigned int z, unsigned char val) {
-    point_cloud_data(x,y,z) = val;
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    uint32_t bit = (uint32_t)1 << (PCD_BRICK_BIT(x,y,z) & 31);
+    if (val) {
+        point_cloud_data[PCD_BRICK_WORD(x,y,z)] |= bit;
+    } else {
+        point_cloud_data[PCD_BRICK_WORD(x,y,z)] &= ~bit;
+    }
+#elif PCD_LAYOUT == PCD_LAYOUT_RUNS
+    put_bits(x, y, z, 1, val ? 1 : 0);
+#else
+    set(PCD_INDEX(x,y,z), val);
+#endif
+}
+
+// Returns the points (x..x+count-1, y, z) as bits (count <= 32, bit i is point x+i)
+uint32_t PointCloud::get_bits(unsigned int x, unsigned int y, unsigned int z, int count) const {
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    // 4 bits per brick, the next brick in x is 2 words further
+    unsigned int word = PCD_BRICK_WORD(x,y,z), shift = PCD_BRICK_BIT(0,y,z) & 31;
+    if ((x & 3) + count <= 4) return (point_cloud_data[word] >> (shift + (x & 3))) & bit_range(count);
+    uint32_t bits = 0;
+    for (int i = 0, n; i < count; i += n, word += 2) {
+        unsigned int xi = (x + i) & 3;
+        n = 4 - xi;
+        if (n > count - i) n = count - i;
+        bits |= ((point_cloud_data[word] >> (shift + xi)) & bit_range(n)) << i;
+    }
+    return bits;
+#elif PCD_LAYOUT == PCD_LAYOUT_RUNS
+    // Overlap of each run with [x,x+count)
+    const RunRow &row = rows[y + z*SIZE];
+    const uint16_t *runs = ROW_RUNS(row);
+    uint32_t bits = 0;
+    for (int i=0; i<row.count && runs[i*2] < x + count; i++) {
+        if (runs[i*2+1] <= x) continue;
+        unsigned int begin = (runs[i*2] > x) ? runs[i*2] - x : 0;
+        unsigned int end = (runs[i*2+1] < x + count) ? runs[i*2+1] - x : count;
+        bits |= bit_range(end - begin) << begin;
+    }
+    return bits;
+#else
+    unsigned int index = PCD_INDEX(x,y,z);
+    unsigned int word = index >> 5, shift = index & 31;
+    uint32_t bits = point_cloud_data[word] >> shift;
+    if (shift + count > 32) bits |= point_cloud_data[word + 1] << (32 - shift);
+    return bits & bit_range(count);
+#endif
+}
+
+// Clears the points (x..x+count-1, y, z) whose bit in mask is 0 (count <= 32)
+void PointCloud::and_bits(unsigned int x, unsigned int y, unsigned int z, int count, uint32_t mask) {
+    uint32_t clear = bit_range(count) & ~mask;
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    unsigned int word = PCD_BRICK_WORD(x,y,z), shift = PCD_BRICK_BIT(0,y,z) & 31;
+    for (int i = 0, n; i < count; i += n, word += 2) {
+        unsigned int xi = (x + i) & 3;
+        n = 4 - xi;
+        if (n > count - i) n = count - i;
+        point_cloud_data[word] &= ~(((clear >> i) & bit_range(n)) << (shift + xi));
+    }
+#elif PCD_LAYOUT == PCD_LAYOUT_RUNS
+    // Intersect the runs with the kept intervals (nothing to do if no point is cleared)
+    uint32_t bits = get_bits(x, y, z, count);
+    if (bits & clear) put_bits(x, y, z, count, bits & ~clear);
+#else
+    unsigned int index = PCD_INDEX(x,y,z);
+    unsigned int word = index >> 5, shift = index & 31;
+    point_cloud_data[word] &= ~(clear << shift);
+    if (shift + count > 32) point_cloud_data[word + 1] &= ~(clear >> (32 - shift));
+#endif
+}
+
+// Sets the points (x..x+count-1, y, z) to bits (count <= 32)
+void PointCloud::put_bits(unsigned int x, unsigned int y, unsigned int z, int count, uint32_t bits) {
+    bits &= bit_range(count);
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    unsigned int word = PCD_BRICK_WORD(x,y,z), shift = PCD_BRICK_BIT(0,y,z) & 31;
+    for (int i = 0, n; i < count; i += n, word += 2) {
+        unsigned int xi = (x + i) & 3;
+        n = 4 - xi;
+        if (n > count - i) n = count - i;
+        point_cloud_data[word] = (point_cloud_data[word] & ~(bit_range(n) << (shift + xi))) |
+                                 (((bits >> i) & bit_range(n)) << (shift + xi));
+    }
+#elif PCD_LAYOUT == PCD_LAYOUT_RUNS
+    // The runs before x, the runs of bits, then the runs after x+count
+    RunRow &row = rows[y + z*SIZE];
+    const uint16_t *runs = ROW_RUNS(row);
+    uint16_t merged[PCD_SIZE + 2];
+    int merged_count = 0;
+    for (int i=0; i<row.count && runs[i*2] < x; i++) {
+        append_run(merged, merged_count, runs[i*2], (runs[i*2+1] < x) ? runs[i*2+1] : x);
+    }
+    for (int i=0; i<count; ) {
+        if (((bits >> i) & 1) == 0) {
+            i++;
+            continue;
+        }
+        int begin = i;
+        while (i < count && ((bits >> i) & 1)) i++;
+        append_run(merged, merged_count, x + begin, x + i);
+    }
+    for (int i=0; i<row.count; i++) {
+        if (runs[i*2+1] <= x + count) continue;
+        append_run(merged, merged_count, (runs[i*2] > x + count) ? runs[i*2] : x + count, runs[i*2+1]);
+    }
+    // If the row cannot grow it keeps its points (carving stays conservative)
+    assign_row(row, merged, merged_count);
+#else
+    unsigned int index = PCD_INDEX(x,y,z);
+    unsigned int word = index >> 5, shift = index & 31;
+    point_cloud_data[word] = (point_cloud_data[word] & ~(bit_range(count) << shift)) | (bits << shift);
+    if (shift + count > 32) {
+        point_cloud_data[word + 1] = (point_cloud_data[word + 1] & ~(bit_range(count) >> (32 - shift))) | (bits >> (32 - shift));
+    }
+#endif
+}
+
+// Returns the 3x3x3 points around (x,y,z) as bits (bit (i+1)+3(j+1)+9(k+1) is point (x+i,y+j,z+k)).
+// (x,y,z) must not be on the border of the grid.
+uint32_t PointCloud::neighbourhood(unsigned int x, unsigned int y, unsigned int z) const {
+    uint32_t bits = 0;
+    for (int k=0; k<3; k++) {
+        for (int j=0; j<3; j++) {
+            bits |= get_bits(x-1, y+j-1, z+k-1, 3) << (3*j + 9*k);
+        }
+    }
+    return bits;
+}
+
+// Returns the 8 corners of the cube between (x,y,z) and (x+1,y+1,z+1) as bits,
+// in the corner order of the marching cubes tables
+unsigned int PointCloud::cube(unsigned int x, unsigned int y, unsigned int z) const {
+    uint32_t bottom = get_bits(x, y, z, 2), back = get_bits(x, y+1, z, 2);
+    uint32_t top = get_bits(x, y, z+1, 2), top_back = get_bits(x, y+1, z+1, 2);
+    return bottom | ((back >> 1) << 2) | ((back & 1) << 3) |
+           (top << 4) | ((top_back >> 1) << 6) | ((top_back & 1) << 7);
+}
+
+// Returns the points of the brick (bx,by,bz) as 64 bits (bit PCD_BRICK_BIT(x,y,z) of bits[0..1]).
+// Voxels outside the grid are 0.
+void PointCloud::get_brick(unsigned int bx, unsigned int by, unsigned int bz, uint32_t bits[2]) const {
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    unsigned int word = PCD_BRICK_WORD(bx*4, by*4, bz*4);
+    bits[0] = point_cloud_data[word];
+    bits[1] = point_cloud_data[word + 1];
+#else
+    bits[0] = bits[1] = 0;
+    for (unsigned int z=bz*4; z<bz*4+4 && z<(unsigned int)SIZE; z++) {
+        for (unsigned int y=by*4; y<by*4+4 && y<(unsigned int)SIZE; y++) {
+            int count = (SIZE - bx*4 < 4) ? (SIZE - bx*4) : 4;
+            bits[(z >> 1) & 1] |= get_bits(bx*4, y, z, count) << (PCD_BRICK_BIT(0,y,z) & 31);
+        }
+    }
+#endif
+}
+
+// Sets the points of the brick (bx,by,bz) from 64 bits (bits of voxels outside the grid are ignored)
+void PointCloud::set_brick(unsigned int bx, unsigned int by, unsigned int bz, const uint32_t bits[2]) {
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    uint32_t mask[2];
+    brick_mask(bx, by, bz, mask);
+    unsigned int word = PCD_BRICK_WORD(bx*4, by*4, bz*4);
+    point_cloud_data[word] = bits[0] & mask[0];
+    point_cloud_data[word + 1] = bits[1] & mask[1];
+#else
+    for (unsigned int z=bz*4; z<bz*4+4 && z<(unsigned int)SIZE; z++) {
+        for (unsigned int y=by*4; y<by*4+4 && y<(unsigned int)SIZE; y++) {
+            int count = (SIZE - bx*4 < 4) ? (SIZE - bx*4) : 4;
+            put_bits(bx*4, y, z, count, bits[(z >> 1) & 1] >> (PCD_BRICK_BIT(0,y,z) & 31));
+        }
+    }
+#endif
+}
+
+// Copies the points to a grid in the linear layout (bit i of word n is voxel PCD_INDEX 32n+i)
+void PointCloud::to_linear(uint32_t words[PCD_LINEAR_WORDS]) const {
+#if PCD_LAYOUT != PCD_LAYOUT_LINEAR
+    for (int i=0; i<PCD_LINEAR_WORDS; i++) words[i] = 0;
+    for (int z=0; z<SIZE; z++) {
+        for (int y=0; y<SIZE; y++) {
+            for (int x=0; x<SIZE; x+=32) {
+                int count = (SIZE - x < 32) ? (SIZE - x) : 32;
+                uint32_t bits = get_bits(x, y, z, count);
+                unsigned int index = PCD_INDEX(x,y,z), shift = index & 31;
+                words[index >> 5] |= bits << shift;
+                if (shift + count > 32) words[(index >> 5) + 1] |= bits >> (32 - shift);
+            }
+        }
+    }
+#else
+    for (int i=0; i<PCD_LINEAR_WORDS; i++) words[i] = point_cloud_data[i];
+#endif
+}
+
+// Sets the points from a grid in the linear layout
+void PointCloud::from_linear(const uint32_t words[PCD_LINEAR_WORDS]) {
+#if PCD_LAYOUT != PCD_LAYOUT_LINEAR
+    for (int z=0; z<SIZE; z++) {
+        for (int y=0; y<SIZE; y++) {
+            for (int x=0; x<SIZE; x+=32) {
+                int count = (SIZE - x < 32) ? (SIZE - x) : 32;
+                unsigned int index = PCD_INDEX(x,y,z), shift = index & 31;
+                uint32_t bits = words[index >> 5] >> shift;
+                if (shift + count > 32) bits |= words[(index >> 5) + 1] << (32 - shift);
+                put_bits(x, y, z, count, bits);
+            }
+        }
+    }
+#else
+    for (int i=0; i<PCD_LINEAR_WORDS; i++) point_cloud_data[i] = words[i];
+    // Bits past the last point stay 0
+    if ((SIZE*SIZE*SIZE) % 32) point_cloud_data[PCD_WORDS-1] &= bit_range((SIZE*SIZE*SIZE) % 32);
+#endif
 }
 
 // Clear all points
 void PointCloud::clear(void) {
-    for (int z=0;z<SIZE;z++) {
-        for (int y=0;y<SIZE;y++) {
-            for (int x=0;x<SIZE;x++) {
-                point_cloud_data(x,y,z) = 1;
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+    // Voxels of the padding in the last bricks stay 0
+    for (int bz=0; bz<PCD_BRICKS; bz++) {
+        for (int by=0; by<PCD_BRICKS; by++) {
+            for (int bx=0; bx<PCD_BRICKS; bx++) {
+                brick_mask(bx, by, bz, &point_cloud_data[PCD_BRICK_WORD(bx*4, by*4, bz*4)]);
             }
         }
     }
+#elif PCD_LAYOUT == PCD_LAYOUT_RUNS
+    // One run [0,SIZE) per row
+    free_rows();
+    for (int i=0; i<SIZE*SIZE; i++) {
+        rows[i].count = 1;
+        rows[i].local[0] = 0;
+        rows[i].local[1] = SIZE;
+    }
+#else
+    for (int i=0; i<PCD_WORDS; i++) {
+        point_cloud_data[i] = 0xffffffff;
+    }
+    // Bits past the last point stay 0
+    if ((SIZE*SIZE*SIZE) % 32) point_cloud_data[PCD_WORDS-1] = bit_range((SIZE*SIZE*SIZE) % 32);
+#endif
+}
+
+// Returns the memory used by the points
+size_t PointCloud::storage_bytes(void) const {
+    size_t bytes = sizeof(*this);
+#if PCD_LAYOUT == PCD_LAYOUT_RUNS
+    for (int i=0; i<SIZE*SIZE; i++) {
+        bytes += rows[i].capacity * 2 * sizeof(uint16_t);
+    }
+#endif
+    return bytes;
+}
+
+// Bit k of the position of bit i in a word is set in mask k
+static const uint32_t bit_position_masks[5] = {
+    0xaaaaaaaa, 0xcccccccc, 0xf0f0f0f0, 0xff00ff00, 0xffff0000
+};
+
+// Measures the points in one pass over the rows, 32 voxels at a time: the volume and the
+// centroid from popcounts, the bounding box from the OR of the rows, and the exposed faces
+// from the ends of the runs in the row and the changes against the previous row and slice.
+void PointCloud::measure(PCD_METRICS &metrics) const {
+    TRACE_SCOPE("measure");
+    const int words = (SIZE + 31) / 32;
+    uint32_t columns[(PCD_SIZE + 31) / 32];     // OR of the rows
+    uint64_t voxels = 0, sum[3] = { 0, 0, 0 };
+    uint32_t faces = 0;
+    int min_y = SIZE, max_y = -1, min_z = SIZE, max_z = -1;
+
+    for (int i=0; i<words; i++) columns[i] = 0;
+    for (int z=0; z<SIZE; z++) {
+        for (int y=0; y<SIZE; y++) {
+            uint32_t carry = 0;     // last point of the previous word of the row
+            uint32_t row = 0;
+            for (int x=0, w=0; x<SIZE; x+=32, w++) {
+                int count = (SIZE - x < 32) ? (SIZE - x) : 32;
+                uint32_t bits = get_bits(x, y, z, count);
+                uint32_t before_y = (y > 0) ? get_bits(x, y-1, z, count) : 0;
+                uint32_t before_z = (z > 0) ? get_bits(x, y, z-1, count) : 0;
+                faces += __builtin_popcount(bits ^ before_y) + __builtin_popcount(bits ^ before_z);
+                if (bits == 0) {
+                    carry = 0;
+                    continue;
+                }
+                // The faces on the far side of the grid
+                if (y == SIZE-1) faces += __builtin_popcount(bits);
+                if (z == SIZE-1) faces += __builtin_popcount(bits);
+                // Two faces for each run along x (a run starts at a point after a clear one)
+                faces += 2 * __builtin_popcount(bits & ~((bits << 1) | carry));
+                carry = (bits >> (count - 1)) & 1;
+
+                uint32_t n = __builtin_popcount(bits), offsets = 0;
+                for (int k=0; k<5; k++) offsets += __builtin_popcount(bits & bit_position_masks[k]) << k;
+                voxels += n;
+                sum[0] += (uint64_t)n * x + offsets;
+                sum[1] += (uint64_t)n * y;
+                sum[2] += (uint64_t)n * z;
+                columns[w] |= bits;
+                row |= bits;
+            }
+            if (row) {
+                if (y < min_y) min_y = y;
+                if (y > max_y) max_y = y;
+                if (z < min_z) min_z = z;
+                max_z = z;
+            }
+        }
+    }
+
+    double scale = SCALE;
+    metrics.voxels = (uint32_t)voxels;
+    metrics.faces = faces;
+    metrics.volume = voxels * scale * scale * scale;
+    metrics.area = faces * scale * scale;
+    for (int j=0; j<3; j++) {
+        metrics.centroid[j] = metrics.min[j] = metrics.max[j] = 0;
+    }
+    if (voxels == 0) return;
+
+    int min_x = SIZE, max_x = -1;
+    for (int w=0; w<words; w++) {
+        if (columns[w] == 0) continue;
+        if (min_x == SIZE) min_x = w * 32 + __builtin_ctz(columns[w]);
+        max_x = w * 32 + 31 - __builtin_clz(columns[w]);
+    }
+    int mins[3] = { min_x, min_y, min_z }, maxs[3] = { max_x, max_y, max_z };
+    for (int j=0; j<3; j++) {
+        metrics.centroid[j] = (double)sum[j] / voxels * scale;
+        metrics.min[j] = (mins[j] - 0.5) * scale;
+        metrics.max[j] = (maxs[j] + 0.5) * scale;
+    }
 }
 
 // Finalize point clouds
 void PointCloud::finalize(void) {
+    TRACE_SCOPE("finalize");
+
     // Invert Y axis
     for (int z=0; z<SIZE; z++) {
         for (int y=0; y<SIZE/2; y++) {
-            for (int x=0; x<SIZE; x++) {
-                char val = point_cloud_data(x, y, z);
-                point_cloud_data(x, y, z) = point_cloud_data(x, (SIZE-y), z);
-                point_cloud_data(x, (SIZE-y), z) = val;
+            for (int x=0; x<SIZE; x+=32) {
+                int count = (SIZE - x < 32) ? (SIZE - x) : 32;
+                uint32_t bits = get_bits(x, y, z, count);
+                put_bits(x, y, z, count, get_bits(x, (SIZE-1-y), z, count));
+                put_bits(x, (SIZE-1-y), z, count, bits);
             }
         }
     }
@@ -82,12 +538,12 @@ void PointCloud::finalize(void) {
     // Remove surface points for better meshing
     for (int i=0; i<SIZE; i++) {
         for (int j=0; j<SIZE; j++) {
-            point_cloud_data(i,j,0) = 0;
-            point_cloud_data(i,0,j) = 0;
-            point_cloud_data(0,i,j) = 0;
-            point_cloud_data(i,j,SIZE-1) = 0;
-            point_cloud_data(i,SIZE-1,j) = 0;
-            point_cloud_data(SIZE-1,i,j) = 0;
+            set(i, j, 0, 0);
+            set(i, 0, j, 0);
+            set(0, i, j, 0);
+            set(i, j, SIZE-1, 0);
+            set(i, SIZE-1, j, 0);
+            set(SIZE-1, i, j, 0);
         }
     }
 
@@ -95,19 +551,11 @@ void PointCloud::finalize(void) {
     for (int z=1; z<SIZE-1; z++) {
         for (int y=1; y<SIZE-1; y++) {
             for (int x=1; x<SIZE-1; x++) {
-                if (point_cloud_data(x,y,z) == 1) {
-
-                    int count = 0;
-                    for (int i=-1;i<2;i++) {
-                        for (int j=-1;j<2;j++) {
-                            for (int k=-1;k<2;k++) {
-                                if (point_cloud_data((x+i),(y+j),(z+k)) == 0) count++;
-                            }
-                        }
-                    }
+                if (get(x,y,z) == 1) {
 
+                    int count = 27 - __builtin_popcount(neighbourhood(x, y, z));
                     if (count>24) {
-                        point_cloud_data(x,y,z) = 0;
+                        set(x, y, z, 0);
                     }
                 }
             }
@@ -115,143 +563,10 @@ void PointCloud::finalize(void) {
     }
 }
 
-// Save point clouds as PLY file with surface reconstruction
-void PointCloud::save_as_ply(const char* file_name) {
-    FILE *fp_ply = fopen(file_name, "w");
-
-    TRIANGLE triangles[5];
-    GRIDCELL grid;
-
-    // Count the number of faces
-    int x,y,z;
-    int face_count=0;
-    for (z=0; z<SIZE-1; z++) {
-        for (y=0; y<SIZE-1; y++) {
-            for (x=0; x<SIZE-1; x++) {
-                grid.p[0].x = x; 
-                grid.p[0].y = y; 
-                grid.p[0].z = z;
-                grid.val[0] = point_cloud_data(x, y, z);
-
-                grid.p[1].x = x+1;
-                grid.p[1].y = y;
-                grid.p[1].z = z;
-                grid.val[1] = point_cloud_data(x+1, y, z);
-
-                grid.p[2].x = x+1;
-                grid.p[2].y = y+1;
-                grid.p[2].z = z;
-                grid.val[2] = point_cloud_data(x+1, y+1, z);
-
-                grid.p[3].x = x;
-                grid.p[3].y = y+1;
-                grid.p[3].z = z;
-                grid.val[3] = point_cloud_data(x, y+1, z);
-
-                grid.p[4].x = x;
-                grid.p[4].y = y;
-                grid.p[4].z = z+1;
-                grid.val[4] = point_cloud_data(x, y, z+1);
-
-                grid.p[5].x = x+1;
-                grid.p[5].y = y;
-                grid.p[5].z = z+1;
-                grid.val[5] = point_cloud_data(x+1, y, z+1);
-
-                grid.p[6].x = x+1;
-                grid.p[6].y = y+1;
-                grid.p[6].z = z+1;
-                grid.val[6] = point_cloud_data(x+1, y+1, z+1);
-                
-                grid.p[7].x = x;
-                grid.p[7].y = y+1;
-                grid.p[7].z = z+1;
-                grid.val[7] = point_cloud_data(x, y+1, z+1);
-
-                int ret = Polygonise(grid, 1, triangles);
-                face_count += ret;
-            }
-        }
-    }
-
-	// Write PLY file header
-    fprintf(fp_ply,"ply\n");
-    fprintf(fp_ply,"format ascii 1.0\n");
-    fprintf(fp_ply,"element vertex %d\n", face_count*3);
-    fprintf(fp_ply,"property float x\n");
-    fprintf(fp_ply,"property float y\n");
-    fprintf(fp_ply,"property float z\n");
-    fprintf(fp_ply,"element face %d\n", face_count);
-    fprintf(fp_ply,"property list uint8 int32 vertex_indices\n");
-    fprintf(fp_ply,"end_header\n");
-
-    // Write vertex
-    for (z=0; z<SIZE-1; z++) {
-        for (y=0; y<SIZE-1; y++) {
-            for (x=0; x<SIZE-1; x++) {
-                grid.p[0].x = x; 
-                grid.p[0].y = y; 
-                grid.p[0].z = z;
-                grid.val[0] = point_cloud_data(x, y, z);
-
-                grid.p[1].x = x+1;
-                grid.p[1].y = y;
-                grid.p[1].z = z;
-                grid.val[1] = point_cloud_data(x+1, y, z);
-
-                grid.p[2].x = x+1;
-                grid.p[2].y = y+1;
-                grid.p[2].z = z;
-                grid.val[2] = point_cloud_data(x+1, y+1, z);
-
-                grid.p[3].x = x;
-                grid.p[3].y = y+1;
-                grid.p[3].z = z;
-                grid.val[3] = point_cloud_data(x, y+1, z);
-
-                grid.p[4].x = x;
-                grid.p[4].y = y;
-                grid.p[4].z = z+1;
-                grid.val[4] = point_cloud_data(x, y, z+1);
-
-                grid.p[5].x = x+1;
-                grid.p[5].y = y;
-                grid.p[5].z = z+1;
-                grid.val[5] = point_cloud_data(x+1, y, z+1);
-
-                grid.p[6].x = x+1;
-                grid.p[6].y = y+1;
-                grid.p[6].z = z+1;
-                grid.val[6] = point_cloud_data(x+1, y+1, z+1);
-                
-                grid.p[7].x = x;
-                grid.p[7].y = y+1;
-                grid.p[7].z = z+1;
-                grid.val[7] = point_cloud_data(x, y+1, z+1);
-
-                int ret = Polygonise(grid, 1, triangles);
-                for (int i=0; i<ret; i++) {
-                    for (int j=0;j<3;j++) {
-                        //triangles
-                        fprintf(fp_ply,"%g %g %g\n", triangles[i].p[j].x*SCALE, triangles[i].p[j].y*SCALE, triangles[i].p[j].z*SCALE);
-                    }
-                }
-            }
-        }
-    }
-
-    // Write face
-    for (int i=0;i<face_count;i++) {
-        int idx = i*3;
-        fprintf(fp_ply,"3 %d %d %d\n", idx, idx+1, idx+2);
-    }
-
-	fclose(fp_ply);
-}
-
-// Compute normal
-XYZ PointCloud::compute_normal(TRIANGLE triangle) {
-    XYZ ab, bc;
+// Compute normal, returns false for a degenerate triangle
+template <typename T>
+static bool compute_normal(const TRIANGLE_T<T> &triangle, XYZ_T<T> &normal) {
+    XYZ_T<T> ab, bc;
     ab.x = triangle.p[1].x - triangle.p[0].x;
     ab.y = triangle.p[1].y - triangle.p[0].y;
     ab.z = triangle.p[1].z - triangle.p[0].z;
@@ -259,129 +574,276 @@ XYZ PointCloud::compute_normal(TRIANGLE triangle) {
     bc.y = triangle.p[2].y - triangle.p[1].y;
     bc.z = triangle.p[2].z - triangle.p[1].z;
 
-    XYZ normal;
     normal.x = (ab.y * bc.z) - (ab.z * bc.y);
     normal.y = (ab.z * bc.x) - (ab.x * bc.z);
     normal.z = (ab.x * bc.y) - (ab.y * bc.x);
 
-    double length = pow( ( normal.x * normal.x ) + ( normal.y * normal.y ) + ( normal.z * normal.z ), 0.5 );
+    T length = scalar_sqrt( ( normal.x * normal.x ) + ( normal.y * normal.y ) + ( normal.z * normal.z ) );
+    if (length == T(0)) return false;
     normal.x /= length;
     normal.y /= length;
     normal.z /= length;
 
-    return normal;
+    return true;
 }
 
-// Save point clouds as STL file with surface reconstruction
-void PointCloud::save_as_stl(const char* file_name) {
-    FILE *fp_stl = fopen(file_name, "wb");
+// Converts to the mesh output type
+template <typename T>
+static XYZ to_xyz(const XYZ_T<T> &p) {
+    XYZ xyz = { (float)to_double(p.x), (float)to_double(p.y), (float)to_double(p.z) };
+    return xyz;
+}
+
+// Corners of a cube in the order of the marching cubes tables (and of cube())
+static const int corners[8][3] = {
+    {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1}
+};
+
+// Surface nets vertex of a cube relative to its corner 0 for each corner mask:
+// the mean of the midpoints of the edges crossing the surface
+static struct NetVertexTable {
+    float offset[256][3];
+
+    NetVertexTable() {
+        static const int edges[12][2] = {
+            {0,1}, {1,2}, {2,3}, {3,0}, {4,5}, {5,6}, {6,7}, {7,4}, {0,4}, {1,5}, {2,6}, {3,7}
+        };
+        for (int mask=0; mask<256; mask++) {
+            float sum[3] = { 0, 0, 0 };
+            int count = 0;
+            for (int i=0; i<12; i++) {
+                int a = edges[i][0], b = edges[i][1];
+                if (((mask >> a) & 1) == ((mask >> b) & 1)) continue;
+                for (int j=0; j<3; j++) sum[j] += (corners[a][j] + corners[b][j]) * 0.5f;
+                count++;
+            }
+            for (int j=0; j<3; j++) offset[mask][j] = count ? sum[j] / count : 0.5f;
+        }
+    }
+} net_vertex;
+
+// Polygonises the cube between (x,y,z) and (x+1,y+1,z+1), returns the number of triangles
+template <typename T>
+int PointCloud::polygonise_cell(int x, int y, int z, TRIANGLE_T<T> *triangles) const {
+    // No surface in an empty or a full cube
+    unsigned int values = cube(x, y, z);
+    if (values == 0 || values == 0xff) return 0;
+
+    GRIDCELL_T<T> grid;
+    for (int i=0; i<8; i++) {
+        grid.p[i].x = T(x + corners[i][0]);
+        grid.p[i].y = T(y + corners[i][1]);
+        grid.p[i].z = T(z + corners[i][2]);
+        grid.val[i] = T((int)((values >> i) & 1));
+    }
+    return Polygonise(grid, T(1), triangles);
+}
+
+#if GEOMETRY_VALIDATE
+// Records the error of a cell against the double reference
+static void validate_cell(const TRIANGLE_T<geom_t> *triangles, int count, const TRIANGLE_T<double> *reference, int reference_count) {
+    geometry_error.cells++;
+    if (count != reference_count) {
+        geometry_error.cell_mismatches++;
+        return;
+    }
+    for (int i=0; i<count; i++) {
+        for (int j=0; j<3; j++) {
+            double dx = to_double(triangles[i].p[j].x) - reference[i].p[j].x;
+            double dy = to_double(triangles[i].p[j].y) - reference[i].p[j].y;
+            double dz = to_double(triangles[i].p[j].z) - reference[i].p[j].z;
+            double error = sqrt(dx*dx + dy*dy + dz*dz);
+            if (error > geometry_error.max_vertex_error) geometry_error.max_vertex_error = error;
+        }
+
+        XYZ_T<geom_t> normal;
+        XYZ_T<double> reference_normal;
+        bool valid = compute_normal(triangles[i], normal);
+        if (valid != compute_normal(reference[i], reference_normal)) {
+            geometry_error.cell_mismatches++;
+        } else if (valid) {
+            double errors[3] = {
+                fabs(to_double(normal.x) - reference_normal.x),
+                fabs(to_double(normal.y) - reference_normal.y),
+                fabs(to_double(normal.z) - reference_normal.z)
+            };
+            for (int j=0; j<3; j++) {
+                if (errors[j] > geometry_error.max_normal_error) geometry_error.max_normal_error = errors[j];
+            }
+        }
+    }
+}
+#endif
+
+// Meshes the cube between (x,y,z) and (x+1,y+1,z+1) in mm, returns the number of triangles.
+// Degenerate triangles (no normal) are skipped.
+int PointCloud::mesh_cell(int x, int y, int z, XYZ normals[5], TRIANGLE triangles[5]) const {
+    TRIANGLE_T<geom_t> cell[5];
+#if GEOMETRY_VALIDATE
+    TRIANGLE_T<double> reference[5];
+#endif
+    int ret = polygonise_cell(x, y, z, cell);
+#if GEOMETRY_VALIDATE
+    validate_cell(cell, ret, reference, polygonise_cell(x, y, z, reference));
+#endif
+
+    int count = 0;
+    for (int i=0; i<ret; i++) {
+        XYZ_T<geom_t> normal;
+        if (!compute_normal(cell[i], normal)) continue;
+
+        TRIANGLE &triangle = triangles[count];
+        for (int j=0;j<3;j++) {
+            triangle.p[j] = to_xyz(cell[i].p[j]);
+            triangle.p[j].x *= SCALE;
+            triangle.p[j].y *= SCALE;
+            triangle.p[j].z *= SCALE;
+        }
+        normals[count++] = to_xyz(normal);
+    }
+    return count;
+}
 
-    uint8_t header[80] = {0};
-    uint32_t face_count = 0;
-    uint16_t stub = 0;
+// Returns the surface nets vertex of the cube between (x,y,z) and (x+1,y+1,z+1) in mm
+XYZ PointCloud::net_vertex_at(int x, int y, int z) const {
+    const float *offset = net_vertex.offset[cube(x, y, z)];
+    XYZ p = { (x + offset[0]) * SCALE, (y + offset[1]) * SCALE, (z + offset[2]) * SCALE };
+    return p;
+}
 
-    TRIANGLE triangles[5];
-    GRIDCELL grid;
+// Meshes the faces of the voxel (x,y,z) towards +x, +y and +z with surface nets: each face
+// between a point and an empty voxel becomes a quad (2 triangles) joining the vertices of
+// the 4 cubes around it. Returns the number of triangles (degenerate ones are skipped).
+int PointCloud::net_cell(int x, int y, int z, XYZ normals[6], TRIANGLE triangles[6]) const {
+    unsigned int values = cube(x, y, z);
+    if (values == 0 || values == 0xff) return 0;
+
+    // Cubes around the edge from (x,y,z) to its +x, +y, +z neighbour (corners 1, 3, 4),
+    // ordered so that a point at (x,y,z) gives a quad facing the neighbour
+    static const int around[3][4][3] = {
+        { {0,-1,-1}, {0,0,-1}, {0,0,0}, {0,-1,0} },
+        { {-1,0,-1}, {-1,0,0}, {0,0,0}, {0,0,-1} },
+        { {-1,-1,0}, {0,-1,0}, {0,0,0}, {-1,0,0} }
+    };
+    static const int neighbour[3] = { 1, 3, 4 };
+
+    int count = 0;
+    for (int axis=0; axis<3; axis++) {
+        unsigned int inside = values & 1;
+        if (((values >> neighbour[axis]) & 1) == inside) continue;
+        // The cubes on the other side of the grid border do not exist (finalize clears it)
+        if ((axis != 0 && x == 0) || (axis != 1 && y == 0) || (axis != 2 && z == 0)) continue;
+
+        XYZ quad[4];
+        for (int i=0; i<4; i++) {
+            quad[i] = net_vertex_at(x + around[axis][i][0], y + around[axis][i][1], z + around[axis][i][2]);
+        }
+        // Reverse the winding when the point is the neighbour
+        static const int order[2][6] = { { 0, 2, 1, 0, 3, 2 }, { 0, 1, 2, 0, 2, 3 } };
+        for (int t=0; t<2; t++) {
+            TRIANGLE &triangle = triangles[count];
+            for (int j=0; j<3; j++) triangle.p[j] = quad[order[inside][t*3 + j]];
+            if (compute_normal(triangle, normals[count])) count++;
+        }
+    }
+    return count;
+}
+
+// Meshes one cube (marching cubes) or the faces of one voxel (surface nets)
+int PointCloud::mesh_unit(int method, int x, int y, int z, XYZ normals[6], TRIANGLE triangles[6]) const {
+    if (method == MESH_SURFACE_NETS) return net_cell(x, y, z, normals, triangles);
+    return mesh_cell(x, y, z, normals, triangles);
+}
+
+// Surface reconstruction: one pass feeds every sink.
+// Degenerate triangles (no normal) are skipped. Returns false if a sink failed.
+bool PointCloud::generate_mesh(MeshSink *sinks[], int sink_count, int method) {
+    TRACE_SCOPE("generate_mesh");
+    XYZ normals[6];
+    TRIANGLE triangles[6];
+
+    // Sinks still accepting triangles
+    MeshSink *active[MESH_MAX_SINKS];
+    int active_count = 0;
+    bool ok = true;
+    for (int k=0; k<sink_count && k<MESH_MAX_SINKS; k++) {
+        if (sinks[k]->begin()) {
+            active[active_count++] = sinks[k];
+        } else {
+            ok = false;
+        }
+    }
 
-    // Write STL file header
-    fwrite(header, sizeof(header), 1, fp_stl);
-    fwrite(&face_count, sizeof(uint32_t), 1, fp_stl);
-    
-    // Write normal and vertex
     for (int z=0; z<SIZE-1; z++) {
         for (int y=0; y<SIZE-1; y++) {
             for (int x=0; x<SIZE-1; x++) {
-
-                grid.p[0].x = x; 
-                grid.p[0].y = y; 
-                grid.p[0].z = z;
-                grid.val[0] = point_cloud_data(x, y, z);
-
-                grid.p[1].x = x+1;
-                grid.p[1].y = y;
-                grid.p[1].z = z;
-                grid.val[1] = point_cloud_data(x+1, y, z);
-
-                grid.p[2].x = x+1;
-                grid.p[2].y = y+1;
-                grid.p[2].z = z;
-                grid.val[2] = point_cloud_data(x+1, y+1, z);
-
-                grid.p[3].x = x;
-                grid.p[3].y = y+1;
-                grid.p[3].z = z;
-                grid.val[3] = point_cloud_data(x, y+1, z);
-
-                grid.p[4].x = x;
-                grid.p[4].y = y;
-                grid.p[4].z = z+1;
-                grid.val[4] = point_cloud_data(x, y, z+1);
-
-                grid.p[5].x = x+1;
-                grid.p[5].y = y;
-                grid.p[5].z = z+1;
-                grid.val[5] = point_cloud_data(x+1, y, z+1);
-
-                grid.p[6].x = x+1;
-                grid.p[6].y = y+1;
-                grid.p[6].z = z+1;
-                grid.val[6] = point_cloud_data(x+1, y+1, z+1);
-                
-                grid.p[7].x = x;
-                grid.p[7].y = y+1;
-                grid.p[7].z = z+1;
-                grid.val[7] = point_cloud_data(x, y+1, z+1);
-
-                int ret = Polygonise(grid, 1, triangles);
+                int ret = mesh_unit(method, x, y, z, normals, triangles);
                 for (int i=0; i<ret; i++) {
-
-                    XYZ normal = compute_normal(triangles[i]);
-                    if (!isnan(normal.x)) {
-                        // write Normal vector
-                        fwrite(&normal, sizeof(XYZ), 1, fp_stl);
-
-                        // write Vertex
-                        for (int j=0;j<3;j++) {
-                            triangles[i].p[j].x *= SCALE;
-                            triangles[i].p[j].y *= SCALE;
-                            triangles[i].p[j].z *= SCALE;
-                            fwrite(&triangles[i].p[j], sizeof(XYZ), 1, fp_stl);
+                    for (int k=0; k<active_count; k++) {
+                        if (!active[k]->add(normals[i], triangles[i])) {
+                            // Drop the failed sink, the others continue
+                            active[k--] = active[--active_count];
+                            ok = false;
                         }
+                    }
+                }
+            }
+        }
+    }
 
-                        // write unused area
-                        fwrite(&stub, sizeof(uint16_t), 1, fp_stl);
+    for (int k=0; k<active_count; k++) {
+        if (!active[k]->end()) ok = false;
+    }
+    return ok;
+}
 
-                        face_count++;
-                    }
+// Meshes the cubes z0 <= z < z1 into a sink (add() only, in the order of generate_mesh).
+// Reads the voxel slices z0..z1, so slabs can be meshed concurrently. Returns false if the sink failed.
+bool PointCloud::mesh_slab(int z0, int z1, MeshSink *sink, int method) const {
+    XYZ normals[6];
+    TRIANGLE triangles[6];
+    if (z1 > SIZE-1) z1 = SIZE-1;
+    for (int z=z0; z<z1; z++) {
+        for (int y=0; y<SIZE-1; y++) {
+            for (int x=0; x<SIZE-1; x++) {
+                int ret = mesh_unit(method, x, y, z, normals, triangles);
+                for (int i=0; i<ret; i++) {
+                    if (!sink->add(normals[i], triangles[i])) return false;
                 }
             }
         }
     }
-    // Write number of triangles
-    fseek(fp_stl, 80, SEEK_SET);
-    fwrite(&face_count, sizeof(uint32_t), 1, fp_stl);
+    return true;
+}
+
+// Save point clouds as PLY file with surface reconstruction
+void PointCloud::save_as_ply(const char* file_name) {
+    TRACE_SCOPE("save_as_ply");
+    PlySink ply(file_name);
+    MeshSink *sinks[] = { &ply };
+    generate_mesh(sinks, 1);
+}
 
-    fclose(fp_stl);
+// Save point clouds as STL file with surface reconstruction
+void PointCloud::save_as_stl(const char* file_name) {
+    TRACE_SCOPE("save_as_stl");
+    StlSink stl(file_name);
+    MeshSink *sinks[] = { &stl };
+    generate_mesh(sinks, 1);
 }
 
 // Save point clouds as XYZ file
 void PointCloud::save_as_xyz(const char* file_name) {
+    TRACE_SCOPE("save_as_xyz");
     FILE *fp_xyz = fopen(file_name, "w");
 
     for (int z=1; z<SIZE-1; z++) {
         for (int y=1; y<SIZE-1; y++) {
             for (int x=1; x<SIZE-1; x++) {
-                if (point_cloud_data(x,y,z) == 1) {
+                if (get(x,y,z) == 1) {
 
                     // Save surface points  only
-                    int count = 0;
-                    for (int i=-1;i<2;i++) {
-                        for (int j=-1;j<2;j++) {
-                            for (int k=-1;k<2;k++) {
-                                if (point_cloud_data((x+i),(y+j),(z+k)) == 0) count++;
-                            }
-                        }
-                    }
+                    int count = 27 - __builtin_popcount(neighbourhood(x, y, z));
 
                     if (count>4) {
                         // Write a 3D point
@@ -393,4 +855,26 @@ void PointCloud::save_as_xyz(const char* file_name) {
     }
 
     fclose(fp_xyz);
-}
\ No newline at end of file
+}
+
+// Saves the measurements as "name value" lines
+bool save_metrics(const char *file_name, const PCD_METRICS &metrics, const StatsSink *mesh) {
+    FILE *fp = fopen(file_name, "w");
+    if (fp == NULL) return false;
+
+    fprintf(fp, "grid %d %g\n", PointCloud::SIZE, (double)PointCloud::SCALE);
+    fprintf(fp, "voxels %lu\n", (unsigned long)metrics.voxels);
+    fprintf(fp, "volume_mm3 %.1f\n", metrics.volume);
+    fprintf(fp, "voxel_area_mm2 %.1f\n", metrics.area);
+    fprintf(fp, "size_mm %.2f %.2f %.2f\n",
+        metrics.max[0] - metrics.min[0], metrics.max[1] - metrics.min[1], metrics.max[2] - metrics.min[2]);
+    fprintf(fp, "min_mm %.2f %.2f %.2f\n", metrics.min[0], metrics.min[1], metrics.min[2]);
+    fprintf(fp, "max_mm %.2f %.2f %.2f\n", metrics.max[0], metrics.max[1], metrics.max[2]);
+    fprintf(fp, "centroid_mm %.2f %.2f %.2f\n", metrics.centroid[0], metrics.centroid[1], metrics.centroid[2]);
+    if (mesh != NULL) {
+        fprintf(fp, "mesh_triangles %lu\n", (unsigned long)mesh->triangles);
+        fprintf(fp, "mesh_area_mm2 %.1f\n", mesh->area);
+        fprintf(fp, "mesh_volume_mm3 %.1f\n", mesh->volume);
+    }
+    return fclose(fp) == 0;
+}
@@ -27,37 +27,133 @@
 #ifndef TINYPCL_HPP
 #define TINYPCL_HPP
 
+#include <stddef.h>
+#include <stdint.h>
 #include "marchingcubes.hpp"
-#include <bitset>
-using std::bitset;
+#include "mesh_sink.hpp"
 
 //  3D grid size
+//  (host tools may override them, e.g. -DPCD_SIZE=200 -DPCD_SCALE=0.5)
+#ifndef PCD_SIZE
 #define PCD_SIZE 100    // size
+#endif
+#ifndef PCD_SCALE
 #define PCD_SCALE 1.0   // resolution(mm/grid)
+#endif
 
-// Syntax sugar to access voxels
-#define point_cloud_data(x,y,z)  point_cloud_data[(x) + ((y)*PCD_SIZE) + (PCD_SIZE*PCD_SIZE*(z))]
+// Maximum number of sinks fed by one generate_mesh pass
+#define MESH_MAX_SINKS 8
+
+// Surface extraction methods
+#define MESH_MARCHING_CUBES 0   // vertices on the points, up to 5 triangles per cube
+#define MESH_SURFACE_NETS   1   // one vertex per surface cube, one quad per voxel face
+
+// Voxel layouts
+#define PCD_LAYOUT_LINEAR   0   // x is the fastest axis, 32 voxels per word
+#define PCD_LAYOUT_BRICK    1   // 4x4x4 bricks of 64 bits (2 words), bricks in linear order
+#define PCD_LAYOUT_RUNS     2   // runs of set voxels along x for each row (y,z)
+
+// Selected layout (mbed_app.json "pcd-layout", or -DPCD_LAYOUT=n on host builds)
+#ifndef PCD_LAYOUT
+#ifdef MBED_CONF_APP_PCD_LAYOUT
+#define PCD_LAYOUT MBED_CONF_APP_PCD_LAYOUT
+#else
+#define PCD_LAYOUT PCD_LAYOUT_LINEAR
+#endif
+#endif
+
+// Linear index of a voxel (x is the fastest axis)
+#define PCD_INDEX(x,y,z)  ((x) + ((y)*PCD_SIZE) + (PCD_SIZE*PCD_SIZE*(z)))
+
+// Words of a grid in the linear layout (bit i of word n is voxel 32n+i)
+#define PCD_LINEAR_WORDS    ((PCD_SIZE*PCD_SIZE*PCD_SIZE + 31) / 32)
+
+// Bricks per axis (the last one is padded if PCD_SIZE is not a multiple of 4)
+#define PCD_BRICKS  ((PCD_SIZE + 3) / 4)
+
+// Bit of a voxel in its brick (x, then y, then z)
+#define PCD_BRICK_BIT(x,y,z)    (((x) & 3) | (((y) & 3) << 2) | (((z) & 3) << 4))
+
+#if PCD_LAYOUT == PCD_LAYOUT_BRICK
+#define PCD_WORDS   (PCD_BRICKS*PCD_BRICKS*PCD_BRICKS*2)
+#else
+#define PCD_WORDS   PCD_LINEAR_WORDS
+#endif
+
+// Runs stored in a row itself, longer run lists are allocated
+#define PCD_ROW_LOCAL_RUNS  2
+
+// Measurements of the points (PointCloud::measure)
+typedef struct {
+    uint32_t voxels;        // set voxels
+    uint32_t faces;         // voxel faces between a set and a clear voxel (or the outside of the grid)
+    double volume;          // mm^3
+    double area;            // mm^2 of the exposed faces (over-estimates a curved surface, up to 1.5 times for a sphere)
+    double centroid[3];     // mm, in the coordinates of the mesh
+    double min[3], max[3];  // mm, bounding box of the voxel cells (0 if there is no voxel)
+} PCD_METRICS;
 
 class PointCloud {
 public:
     const static int SIZE = PCD_SIZE;
-    const static float SCALE = PCD_SCALE;
+    const static float SCALE;
 
     PointCloud(void);
+#if PCD_LAYOUT == PCD_LAYOUT_RUNS
+    PointCloud(const PointCloud &other);
+    PointCloud &operator=(const PointCloud &other);
+    ~PointCloud();
+#endif
 
-    unsigned char get(unsigned int index);
-    unsigned char get(unsigned int x, unsigned int y, unsigned int z);
+    unsigned char get(unsigned int index) const;
+    unsigned char get(unsigned int x, unsigned int y, unsigned int z) const;
     void set(unsigned int index, unsigned char val);
     void set(unsigned int x, unsigned int y, unsigned int z, unsigned char val);
+    uint32_t get_bits(unsigned int x, unsigned int y, unsigned int z, int count) const;
+    void and_bits(unsigned int x, unsigned int y, unsigned int z, int count, uint32_t mask);
+    uint32_t neighbourhood(unsigned int x, unsigned int y, unsigned int z) const;
+    unsigned int cube(unsigned int x, unsigned int y, unsigned int z) const;
+    void get_brick(unsigned int bx, unsigned int by, unsigned int bz, uint32_t bits[2]) const;
+    void set_brick(unsigned int bx, unsigned int by, unsigned int bz, const uint32_t bits[2]);
+    void to_linear(uint32_t words[PCD_LINEAR_WORDS]) const;
+    void from_linear(const uint32_t words[PCD_LINEAR_WORDS]);
     void clear();
+    size_t storage_bytes() const;
+    void measure(PCD_METRICS &metrics) const;
     void finalize();
     void save_as_stl(const char*);
     void save_as_ply(const char*);
     void save_as_xyz(const char*);
+    bool generate_mesh(MeshSink *sinks[], int sink_count, int method = MESH_MARCHING_CUBES);
+    bool mesh_slab(int z0, int z1, MeshSink *sink, int method = MESH_MARCHING_CUBES) const;
 private:
     // 3D grid representing object space
-    bitset<PCD_SIZE*PCD_SIZE*PCD_SIZE> point_cloud_data;
-    XYZ compute_normal(TRIANGLE triangle);
+#if PCD_LAYOUT == PCD_LAYOUT_RUNS
+    // Runs [begin,end) of the row (y,z), sorted and separated by at least one voxel
+    typedef struct {
+        uint16_t count;         // number of runs
+        uint16_t capacity;      // runs allocated in heap (0: the runs are in local)
+        union {
+            uint16_t local[PCD_ROW_LOCAL_RUNS * 2];
+            uint16_t *heap;
+        };
+    } RunRow;
+    RunRow rows[PCD_SIZE*PCD_SIZE];
+    bool assign_row(RunRow &row, const uint16_t *runs, int count);
+    void free_rows();
+#else
+    uint32_t point_cloud_data[PCD_WORDS];
+#endif
+    void put_bits(unsigned int x, unsigned int y, unsigned int z, int count, uint32_t bits);
+    template <typename T> int polygonise_cell(int x, int y, int z, TRIANGLE_T<T> *triangles) const;
+    int mesh_cell(int x, int y, int z, XYZ normals[5], TRIANGLE triangles[5]) const;
+    XYZ net_vertex_at(int x, int y, int z) const;
+    int net_cell(int x, int y, int z, XYZ normals[6], TRIANGLE triangles[6]) const;
+    int mesh_unit(int method, int x, int y, int z, XYZ normals[6], TRIANGLE triangles[6]) const;
 };
 
+// Saves the measurements (and those of the mesh if not NULL) as "name value" lines,
+// returns false if the file cannot be written
+bool save_metrics(const char *file_name, const PCD_METRICS &metrics, const StatsSink *mesh);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,191 @@
+/*
+** Lightweight latency tracer
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "trace.hpp"
+
+#ifdef __MBED__
+#include "mbed.h"
+#else
+#include <time.h>
+#include <pthread.h>
+#endif
+
+static TRACE_EVENT trace_buffer[TRACE_BUFFER_SIZE];
+static volatile uint32_t trace_count = 0;     // Number of recorded spans (including overwritten ones)
+static volatile uint32_t trace_first = 0;     // Position of the first span not cleared
+
+// Returns the current time (us)
+uint32_t trace_now(void) {
+#ifdef __MBED__
+    return us_ticker_read();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#endif
+}
+
+static uint32_t trace_thread(void) {
+#ifdef __MBED__
+    return (uint32_t)(uintptr_t)osThreadGetId();
+#else
+    return (uint32_t)(uintptr_t)pthread_self();
+#endif
+}
+
+// Records a span into the ring buffer
+void trace_record(const char *name, uint32_t begin, uint32_t end) {
+    // Reserve a slot (safe against other threads and interrupts)
+#ifdef __MBED__
+    uint32_t index = core_util_atomic_incr_u32((uint32_t *)&trace_count, 1) - 1;
+#else
+    uint32_t index = __sync_fetch_and_add(&trace_count, 1);
+#endif
+
+    // Readers skip the span until its sequence is published
+    TRACE_EVENT *event = &trace_buffer[index % TRACE_BUFFER_SIZE];
+    event->sequence = 0;
+    __sync_synchronize();
+    event->name = name;
+    event->thread = trace_thread();
+    event->begin = begin;
+    event->end = end;
+    __sync_synchronize();
+    event->sequence = index + 1;
+}
+
+// Discards all recorded spans
+void trace_clear(void) {
+    trace_first = trace_count;
+}
+
+// Returns the position of the next span
+uint32_t trace_position(void) {
+    return trace_count;
+}
+
+// Reads the span at a position, returns false while it is written or once it is overwritten
+static bool trace_read(uint32_t position, TRACE_EVENT &event) {
+    TRACE_EVENT *slot = &trace_buffer[position % TRACE_BUFFER_SIZE];
+    uint32_t sequence = slot->sequence;
+    __sync_synchronize();
+    event.name = slot->name;
+    event.thread = slot->thread;
+    event.begin = slot->begin;
+    event.end = slot->end;
+    event.sequence = sequence;
+    __sync_synchronize();
+    return sequence == position + 1 && slot->sequence == sequence;
+}
+
+// Copies the written spans in [first, end) still in the ring buffer
+uint32_t trace_copy(uint32_t first, uint32_t end, TRACE_EVENT *events, uint32_t max_count, bool own_thread) {
+    if (end - first > TRACE_BUFFER_SIZE) first = end - TRACE_BUFFER_SIZE;
+    uint32_t thread = trace_thread();
+    uint32_t count = 0;
+    for (uint32_t position = first; position != end && count < max_count; position++) {
+        if (!trace_read(position, events[count])) continue;
+        if (own_thread && events[count].thread != thread) continue;
+        count++;
+    }
+    return count;
+}
+
+// Copies all spans still in the ring buffer (NULL if out of memory)
+static TRACE_EVENT* trace_snapshot(uint32_t &count) {
+    TRACE_EVENT *events = (TRACE_EVENT *)malloc(sizeof(TRACE_EVENT) * TRACE_BUFFER_SIZE);
+    if (events != NULL) count = trace_copy(trace_first, trace_count, events, TRACE_BUFFER_SIZE);
+    return events;
+}
+
+// Returns the begin time of the oldest span (origin of the saved timestamps)
+static uint32_t trace_origin(const TRACE_EVENT *events, uint32_t count) {
+    uint32_t origin = (count > 0) ? events[0].begin : 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if ((int32_t)(events[i].begin - origin) < 0) origin = events[i].begin;
+    }
+    return origin;
+}
+
+// Saves recorded spans as Chrome trace JSON (chrome://tracing, Perfetto)
+int trace_save_json(const char *file_name) {
+    uint32_t count;
+    TRACE_EVENT *events = trace_snapshot(count);
+    if (events == NULL) return -1;
+    int result = trace_save_json(file_name, events, count);
+    free(events);
+    return result;
+}
+
+int trace_save_json(const char *file_name, const TRACE_EVENT *events, uint32_t count) {
+    FILE *fp = fopen(file_name, "w");
+    if (fp == NULL) return -1;
+
+    uint32_t origin = trace_origin(events, count);
+
+    fprintf(fp, "{\"traceEvents\":[\n");
+    for (uint32_t i = 0; i < count; i++) {
+        const TRACE_EVENT *event = &events[i];
+        fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%lu,\"ts\":%lu,\"dur\":%lu}%s\n",
+                event->name, (unsigned long)event->thread,
+                (unsigned long)(event->begin - origin), (unsigned long)(event->end - event->begin),
+                (i + 1 < count) ? "," : "");
+    }
+    fprintf(fp, "],\"displayTimeUnit\":\"ms\"}\n");
+
+    fclose(fp);
+    return (int)count;
+}
+
+// Saves recorded spans as CSV (name,thread,begin_us,duration_us)
+int trace_save_csv(const char *file_name) {
+    uint32_t count;
+    TRACE_EVENT *events = trace_snapshot(count);
+    if (events == NULL) return -1;
+    int result = trace_save_csv(file_name, events, count);
+    free(events);
+    return result;
+}
+
+int trace_save_csv(const char *file_name, const TRACE_EVENT *events, uint32_t count) {
+    FILE *fp = fopen(file_name, "w");
+    if (fp == NULL) return -1;
+
+    uint32_t origin = trace_origin(events, count);
+
+    fprintf(fp, "name,thread,begin_us,duration_us\n");
+    for (uint32_t i = 0; i < count; i++) {
+        const TRACE_EVENT *event = &events[i];
+        fprintf(fp, "%s,%lu,%lu,%lu\n", event->name, (unsigned long)event->thread,
+                (unsigned long)(event->begin - origin), (unsigned long)(event->end - event->begin));
+    }
+
+    fclose(fp);
+    return (int)count;
+}
@@ -0,0 +1,105 @@
+/*
+** Lightweight latency tracer
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <stdint.h>
+#include "mem_profile.hpp"
+
+// Enable tracing (mbed_app.json "trace", or -DTRACE_ENABLE=1 on host builds)
+#ifndef TRACE_ENABLE
+#ifdef MBED_CONF_APP_TRACE
+#define TRACE_ENABLE MBED_CONF_APP_TRACE
+#else
+#define TRACE_ENABLE 0
+#endif
+#endif
+
+// Number of events kept in the ring buffer (older events are overwritten)
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 512
+#endif
+
+// A completed time span
+typedef struct {
+    const char *name;   // Static string (only the pointer is stored)
+    uint32_t thread;    // Thread id
+    uint32_t begin;     // Begin time (us)
+    uint32_t end;       // End time (us)
+    uint32_t sequence;  // Position + 1 once written (0 while a thread writes it)
+} TRACE_EVENT;
+
+// Returns the current time (us)
+uint32_t trace_now(void);
+
+// Records a span into the ring buffer
+void trace_record(const char *name, uint32_t begin, uint32_t end);
+
+// Discards all recorded spans
+void trace_clear(void);
+
+// Returns the position of the next span (spans are numbered in the order they are recorded)
+uint32_t trace_position(void);
+
+// Copies the spans recorded in [first, end) that are written and still in the ring buffer,
+// only those of the calling thread with own_thread. Returns the number of spans copied.
+uint32_t trace_copy(uint32_t first, uint32_t end, TRACE_EVENT *events, uint32_t max_count, bool own_thread = false);
+
+// Saves recorded spans as Chrome trace JSON (chrome://tracing, Perfetto)
+int trace_save_json(const char *file_name);
+int trace_save_json(const char *file_name, const TRACE_EVENT *events, uint32_t count);
+
+// Saves recorded spans as CSV (name,thread,begin_us,duration_us)
+int trace_save_csv(const char *file_name);
+int trace_save_csv(const char *file_name, const TRACE_EVENT *events, uint32_t count);
+
+// Records the lifetime of the object as a span
+class TraceScope {
+public:
+    TraceScope(const char *name) : name(name), begin(trace_now()) {}
+    ~TraceScope() { trace_record(name, begin, trace_now()); }
+private:
+    const char *name;
+    uint32_t begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// Syntax sugar to trace the enclosing scope (also a memory profiling stage with MEMPROF_ENABLE)
+#if TRACE_ENABLE && MEMPROF_ENABLE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name); \
+                          MemScope TRACE_CONCAT(mem_scope_, __LINE__)(name)
+#elif TRACE_ENABLE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#elif MEMPROF_ENABLE
+#define TRACE_SCOPE(name) MemScope TRACE_CONCAT(mem_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+#endif
@@ -0,0 +1,188 @@
+/*
+** Next-best-view planner
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+#include <math.h>
+#include "view_planner.hpp"
+#include "trace.hpp"
+
+using namespace cv;
+
+// Constructor: positions is the number of step positions per revolution,
+// candidates is the number of equally spaced positions the planner chooses from
+ViewPlanner::ViewPlanner(const CameraModel &camera, int positions, int candidates)
+    : camera(camera), positions(positions), candidates(candidates), spacing(positions / candidates) {
+
+    captured = new bool[candidates];
+    scores = new int[candidates];
+    samples = new unsigned int[PLANNER_MAX_SAMPLES];
+    sample_u = new unsigned short[PLANNER_MAX_SAMPLES];
+    sample_v = new unsigned short[PLANNER_MAX_SAMPLES];
+    img_hull = Mat(camera.height / PLANNER_IMAGE_SCALE + 2, camera.width / PLANNER_IMAGE_SCALE + 2, CV_8U);
+    clear();
+}
+
+// Forgets all captured views (call before each scan)
+void ViewPlanner::clear() {
+    views = 0;
+    for (int i = 0; i < candidates; i++) {
+        captured[i] = false;
+        scores[i] = 0;
+    }
+}
+
+// Records a captured view
+void ViewPlanner::add_view(int position) {
+    captured[(position / spacing) % candidates] = true;
+    views++;
+}
+
+// Collects surface voxels (on the sampling lattice) of the current hull
+void ViewPlanner::sample_surface(const PointCloud &point_cloud) {
+    const int size = point_cloud.SIZE;
+    sample_count = 0;
+    for (int z=0; z<size; z+=PLANNER_STRIDE) {
+        for (int y=0; y<size; y+=PLANNER_STRIDE) {
+            for (int x=0; x<size; x+=PLANNER_STRIDE) {
+                if (point_cloud.get(x, y, z) == 0) continue;
+
+                bool surface = (x == 0 || y == 0 || z == 0 || x == size-1 || y == size-1 || z == size-1) ||
+                    point_cloud.get(x-1, y, z) == 0 || point_cloud.get(x+1, y, z) == 0 ||
+                    point_cloud.get(x, y-1, z) == 0 || point_cloud.get(x, y+1, z) == 0 ||
+                    point_cloud.get(x, y, z-1) == 0 || point_cloud.get(x, y, z+1) == 0;
+                if (surface && sample_count < PLANNER_MAX_SAMPLES) {
+                    samples[sample_count++] = x + (y * size) + (size * size * z);
+                }
+            }
+        }
+    }
+}
+
+// Returns the angle (rad) from the candidate to the nearest captured view.
+// Opposite views see the same contour, so angles are folded into [0, pi/2].
+double ViewPlanner::nearest_view(int candidate) const {
+    const double pi = 3.14159265358979;
+    double nearest = pi / 2;
+    for (int i = 0; i < candidates; i++) {
+        if (!captured[i]) continue;
+        double d = fmod(fabs(view_angle((candidate - i) * spacing, positions)), pi);
+        if (d > pi / 2) d = pi - d;
+        if (d < nearest) nearest = d;
+    }
+    return nearest;
+}
+
+// Estimates the number of voxels the candidate view would carve
+int ViewPlanner::score_view(int candidate) {
+    const int size = PointCloud::SIZE;
+    const double origin = (-size / 2) * PointCloud::SCALE;
+    double rad = view_angle(candidate * spacing, positions);
+    int u,v;
+
+    // Expected overshoot of the hull per unit distance from the axis
+    double d = nearest_view(candidate);
+    double overshoot = (d >= 1.5) ? 10.0 : (1.0 / cos(d) - 1.0);
+
+    // Render the hull (2x2 splat per sample, the lattice is PLANNER_STRIDE voxels apart)
+    img_hull.setTo(Scalar(0));
+    for (int i = 0; i < sample_count; i++) {
+        unsigned int index = samples[i];
+        double xx = origin + (index % size) * PointCloud::SCALE;
+        double yy = origin + ((index / size) % size) * PointCloud::SCALE;
+        double zz = origin + (index / (size * size)) * PointCloud::SCALE;
+
+        projection(camera, rad, xx, yy, zz, u, v);
+        if (u < 0 || v < 0 || u >= camera.width || v >= camera.height) {
+            sample_u[i] = 0;    // Outside the image: the voxel will be carved anyway
+            continue;
+        }
+        u = u / PLANNER_IMAGE_SCALE + 1;
+        v = v / PLANNER_IMAGE_SCALE + 1;
+        sample_u[i] = u;
+        sample_v[i] = v;
+        img_hull.at<unsigned char>(v, u) = 1;
+        img_hull.at<unsigned char>(v, u-1) = 1;
+        img_hull.at<unsigned char>(v-1, u) = 1;
+        img_hull.at<unsigned char>(v-1, u-1) = 1;
+    }
+
+    // Sum the expected carving depth (voxels) of samples on the boundary of the projection
+    double score = 0;
+    for (int i = 0; i < sample_count; i++) {
+        u = sample_u[i];
+        v = sample_v[i];
+        if (u != 0 && (u >= 2 && v >= 2 && u < img_hull.cols - 1 && v < img_hull.rows - 1) &&
+            img_hull.at<unsigned char>(v, u-2) != 0 && img_hull.at<unsigned char>(v, u+1) != 0 &&
+            img_hull.at<unsigned char>(v-2, u) != 0 && img_hull.at<unsigned char>(v+1, u) != 0) {
+            continue;
+        }
+
+        unsigned int index = samples[i];
+        double xx = (int)(index % size) - size / 2;
+        double yy = (int)((index / size) % size) - size / 2;
+        score += sqrt(xx * xx + yy * yy) * overshoot;
+    }
+
+    // Each sample stands for PLANNER_STRIDE^2 surface voxels
+    return (int)(score * PLANNER_STRIDE * PLANNER_STRIDE);
+}
+
+// Returns the next turntable position to capture from the current position,
+// or -1 if no candidate scores min_score
+int ViewPlanner::next_view(const PointCloud &point_cloud, int current, int min_score) {
+    TRACE_SCOPE("plan_next_view");
+
+    // Start with equally spaced views so the hull has a rough shape. Opposite views
+    // see the same contour, so they are spread over half a revolution.
+    if (views < PLANNER_INITIAL_VIEWS) {
+        int candidate = (views * candidates / (2 * PLANNER_INITIAL_VIEWS)) % candidates;
+        if (!captured[candidate]) return candidate * spacing;
+    }
+
+    sample_surface(point_cloud);
+
+    int best_score = 0;
+    for (int i = 0; i < candidates; i++) {
+        scores[i] = captured[i] ? 0 : score_view(i);
+        if (scores[i] > best_score) best_score = scores[i];
+    }
+    if (best_score < min_score) return -1;
+
+    // The nearest candidate in the direction of rotation among those close to the best score
+    int threshold = (int)(best_score * PLANNER_TRAVEL_SLACK);
+    if (threshold < min_score) threshold = min_score;
+    int best = -1;
+    int best_travel = positions;
+    for (int i = 0; i < candidates; i++) {
+        if (captured[i] || scores[i] < threshold) continue;
+        int travel = (i * spacing - current + positions) % positions;
+        if (travel < best_travel) {
+            best = i;
+            best_travel = travel;
+        }
+    }
+    return (best < 0) ? -1 : best * spacing;
+}
@@ -0,0 +1,79 @@
+/*
+** Next-best-view planner
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+#ifndef VIEW_PLANNER_HPP
+#define VIEW_PLANNER_HPP
+
+#include "opencv.hpp"
+#include "tinypcl.hpp"
+#include "reconstruction.hpp"
+
+// Planner parameters
+#define PLANNER_INITIAL_VIEWS   4       // number of equally spaced views over half a revolution taken before planning
+#define PLANNER_STRIDE          2       // voxel sampling stride used for scoring
+#define PLANNER_IMAGE_SCALE     4       // downscaling of the image used for scoring
+#define PLANNER_MAX_SAMPLES     16384   // maximum number of surface voxels used for scoring
+#define PLANNER_TRAVEL_SLACK    0.8     // a candidate scoring this fraction of the best one wins if the turntable reaches it sooner
+
+// Chooses the next turntable position by how many surviving voxels it could still carve.
+//
+// The current hull is projected into a small image for each candidate view. Surface
+// voxels on the boundary of that projection are the ones the view can carve. Between
+// two captured views the hull overshoots a smooth object by about r * (1/cos(d) - 1),
+// where r is the distance from the turntable axis and d the angle to the nearest
+// captured view, so each boundary voxel adds that depth to the expected carved volume.
+// The turntable only turns one way, so among candidates scoring close to the best one
+// the planner takes the one with the shortest travel from the current position.
+class ViewPlanner {
+public:
+    ViewPlanner(const CameraModel &camera, int positions, int candidates);
+
+    void clear();
+    void add_view(int position);
+    int next_view(const PointCloud &point_cloud, int current, int min_score);
+    int score(int position) const { return scores[position / spacing]; }
+private:
+    CameraModel camera;
+    int positions;          // step positions per revolution
+    int candidates;         // number of candidate positions
+    int spacing;            // steps between candidate positions
+    int views;              // number of captured views
+
+    bool *captured;
+    int *scores;
+
+    // Sampled surface voxels and their projections (reused for every candidate)
+    unsigned int *samples;
+    unsigned short *sample_u, *sample_v;
+    int sample_count;
+    cv::Mat img_hull;
+
+    void sample_surface(const PointCloud &point_cloud);
+    double nearest_view(int candidate) const;
+    int score_view(int candidate);
+};
+
+#endif
@@ -25,11 +25,21 @@
 ** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
 */
 
+#include <stdarg.h>
 #include "mbed.h"
 #include "SdUsbConnect.h"
 #include "DisplayApp.h"
 #include "tinypcl.hpp"
 #include "camera_if.hpp"
+#include "reconstruction.hpp"
+#include "trace.hpp"
+#include "geometry.hpp"
+#include "view_planner.hpp"
+#include "deferred_carver.hpp"
+#include "hull_preview.hpp"
+#include "preview_scheduler.hpp"
+#include "mesh_stream.hpp"
+#include "mesh_decimator.hpp"
 
 // Extrinsic parameters of the camera (Depends on your enclosure design)
 #define CAMERA_DISTANCE 115     // Distance from the origin to the camera (mm)
@@ -43,6 +53,56 @@
 
 // 3D reconstruction Parameters
 #define SILHOUETTE_COUNTS   40  // number of silhouette to use
+#define CARVE_MODE          CARVE_CENTER    // CARVE_CENTER or CARVE_FOOTPRINT (keeps thin features on coarse grids)
+
+// Deferred carving (0:carve after each view 1:store the silhouettes and carve once after the last view)
+// Needs SILHOUETTE_COUNTS / 8 bytes per pixel and works with CARVE_CENTER only
+#define DEFERRED_CARVING    0
+
+// View planning (0:equally spaced views 1:choose each next view by the voxels it can carve)
+#define VIEW_PLANNING           0
+#define VIEW_PLANNING_MIN_SCORE 100 // stop when no view is expected to carve this many voxels
+
+// Early termination (0:always take SILHOUETTE_COUNTS views 1:stop when the hull converges)
+// Equally spaced views are then taken coarse to fine (see interleaved_view)
+#define CONVERGENCE_STOP        0
+#define CONVERGENCE_VIEWS       3       // number of consecutive views that remove too few voxels
+#define CONVERGENCE_FRACTION    0.002   // fraction of the remaining voxels a view must remove
+#define CONVERGENCE_MIN_VIEWS   8       // never stop before this many views
+
+// Preview during a scan (0:camera image 1:height map of the current hull)
+#define HULL_PREVIEW        0
+
+// Preview streaming to PC (frames per second, 0:none), images that have not changed are skipped
+#define PREVIEW_IDLE_FPS        10      // while waiting for the button
+#define PREVIEW_SCAN_FPS        2       // camera image during a scan, at half resolution
+#define PREVIEW_KEEPALIVE_MS    2000    // resend an unchanged image after this long
+#define PREVIEW_POLL_MS         20      // interval of the button checks
+
+// Surface extraction (MESH_MARCHING_CUBES or MESH_SURFACE_NETS: smoother and closer to the hull volume,
+// but about 1.8 times the triangles on the binary grid)
+#define MESH_METHOD         MESH_MARCHING_CUBES
+
+// Mesh decimation before writing (0:off 1:on, the mesh is kept in memory until it is simplified)
+#define MESH_DECIMATE           0
+#define MESH_DECIMATE_MODE      DECIMATE_CLUSTER    // DECIMATE_CLUSTER (fast) or DECIMATE_QUADRIC (keeps the shape better, slower)
+#define MESH_DECIMATE_RATIO     0.25    // DECIMATE_QUADRIC: fraction of the triangles to keep
+#define MESH_DECIMATE_ERROR     2.0     // DECIMATE_CLUSTER: cell size, DECIMATE_QUADRIC: maximum error (mm)
+#define MESH_DECIMATE_MAX_TRIANGLES 60000   // DECIMATE_QUADRIC: a larger mesh is written without decimation
+
+// Mesh streaming (0:SD card only 1:also send the mesh to tools/mesh_receiver while meshing)
+// The stream shares the USB serial with the console, so set platform.stdio-baud-rate to the same rate
+#define MESH_STREAM         0
+#define MESH_STREAM_BAUD    921600
+
+// Back-to-back scans: number of finished scans whose export can wait while the next scan runs
+// (0:export before the next scan). Each one needs another point cloud.
+#define EXPORT_QUEUE_DEPTH  1
+#define EXPORT_STACK_SIZE   (16 * 1024)     // stack of the export thread (meshing and file system)
+
+#if DEFERRED_CARVING && (VIEW_PLANNING || CONVERGENCE_STOP || CARVE_MODE != CARVE_CENTER)
+#error "DEFERRED_CARVING needs the hull after each view to be unused (VIEW_PLANNING 0, CONVERGENCE_STOP 0, CARVE_CENTER)"
+#endif
 
 // Stepper motor parameters (Depends on your stepper motor)
 #define STEPPER_DIRECTION   1       // Direction (0 or 1)
@@ -52,6 +112,24 @@
 // Stepper motor driver parameters (Depends on your circuit design)
 #define STEPPER_STEP_RESOLUTIONS 4  // full-step = 1, half-step = 2, quarter-step = 4
 
+// Capture timing: each view uses the first frame exposed CAPTURE_SETTLE_MS after the last step
+// that does not differ from the frame before it
+#define CAPTURE_SETTLE_MS   30      // vibration of the turntable after it stops (ms)
+#define CAPTURE_MAX_FRAMES  10      // use the frame anyway after this many moving frames
+
+// Continuous rotation (0:stop the turntable for each view 1:turn it at a constant rate and carve each
+// view at the angle of the middle of its frame, up to SILHOUETTE_COUNTS views in one revolution)
+#define CONTINUOUS_ROTATION     0
+#define CONTINUOUS_REVOLUTION   20.0    // seconds per revolution (long enough to carve every view, and to limit motion blur)
+#define CONTINUOUS_LATENCY_US   0       // time from the middle of the exposure to the middle of the frame transfer (us)
+
+#if CONTINUOUS_ROTATION && (VIEW_PLANNING || CONVERGENCE_STOP)
+#error "CONTINUOUS_ROTATION takes the views in turntable order (VIEW_PLANNING 0, CONVERGENCE_STOP 0)"
+#endif
+
+// Number of step positions per revolution of the turntable
+#define STEPPER_POSITIONS (STEPPER_STEP_COUNTS * STEPPER_STEP_RESOLUTIONS)
+
 // Defines pins numbers (Depends on your circuit design)
 DigitalOut  a4988_step(D8);     // Connect the pin to A4988 step
 DigitalOut  a4988_dir(D9);      // Connect the pin to A4988 dir
@@ -60,81 +138,120 @@ DigitalOut  led_working(D7);    // Connect the pin to LED1 (working)
 DigitalOut  led1(LED1);         // Use onboard LED for debugging purposes
 
 // Global variable for 3D reconstruction
-PointCloud point_cloud;      // Point cloud (3D reconstruction result)
+CameraModel camera = {
+    CAMERA_DISTANCE, CAMERA_OFFSET,
+    CAMERA_CENTER_U, CAMERA_CENTER_V, CAMERA_FX, CAMERA_FY,
+    VIDEO_PIXEL_HW, VIDEO_PIXEL_VW
+};
+
+// Buffers for each view (silhouette, scratch rows and summed-area table), reset every view
+// (sized for the whole image, a view only uses its region of interest)
+#if CARVE_MODE == CARVE_FOOTPRINT
+#define VIEW_SAT_SIZE ARENA_ALIGN(SAT_BYTES(VIDEO_PIXEL_HW, VIDEO_PIXEL_VW))
+#else
+#define VIEW_SAT_SIZE 0
+#endif
+static uint8_t view_arena_buffer[CAMERA_ARENA_SIZE + VIEW_SAT_SIZE]__attribute((aligned(32)));
+Arena view_arena(view_arena_buffer, sizeof(view_arena_buffer));
+
+#if VIEW_PLANNING
+ViewPlanner planner(camera, STEPPER_POSITIONS, SILHOUETTE_COUNTS);
+#endif
+
+// Region of the image each turntable position can see the grid in
+ViewRoi view_roi(camera, STEPPER_POSITIONS);
+
+#if DEFERRED_CARVING
+DeferredCarver deferred_carver(camera, SILHOUETTE_COUNTS, view_roi.max_size());
+#endif
+
+#if HULL_PREVIEW
+HullPreview hull_preview;
+#endif
+
+#if MESH_STREAM
+// The stream shares the console UART: frames and console lines are written under one mutex
+Mutex console_mutex;
+SerialStreamPort stream_port(USBTX, USBRX, MESH_STREAM_BAUD, &console_mutex);
+MeshStream mesh_stream(stream_port);
+#endif
+
+// Console output (the scan and the export thread print, and the mesh stream may share the UART)
+void console_lock(void) {
+#if MESH_STREAM
+    console_mutex.lock();
+#endif
+}
 
+void console_unlock(void) {
+    // Out of the stdio buffer before a frame may follow
+    fflush(stdout);
+#if MESH_STREAM
+    console_mutex.unlock();
+#endif
+}
+
+void console_printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    console_lock();
+    vprintf(format, args);
+    console_unlock();
+    va_end(args);
+}
+
+ConvergenceMonitor convergence(CONVERGENCE_VIEWS, CONVERGENCE_FRACTION, CONVERGENCE_MIN_VIEWS);
+
+// A scan from its first view to the end of its export.
+// Scans use the slots in turn, and exports finish in order.
+struct ScanSlot {
+    PointCloud point_cloud;                 // Point cloud (3D reconstruction result)
+    int index;                              // Number of the result files
+    double view_positions[SILHOUETTE_COUNTS];   // Turntable position (step) of each view
+    int view_count;
+    uint32_t begin;                         // Trace time of the first view
+#if TRACE_ENABLE
+    uint32_t trace_first;                   // Trace position of the first view
+    uint32_t trace_export;                  // and of the export
+    TRACE_EVENT trace_events[TRACE_BUFFER_SIZE];    // Spans of the scan (copied when it ends) and its export
+    uint32_t trace_count;
+#endif
+    bool busy;                              // Scanning or exporting (changed on the event queue only)
+};
+#define SCAN_SLOTS (EXPORT_QUEUE_DEPTH + 1)
+ScanSlot scan_slots[SCAN_SLOTS];
+ScanSlot *scan = &scan_slots[0];    // Current scan
+
+// Scan states
+#define STATE_IDLE      0   // waiting for the button
+#define STATE_SCANNING  1   // taking views, one event per view
+#define STATE_WAITING   2   // button pressed, waiting for an export to free a slot
+int scan_state = STATE_IDLE;
+int scan_step = 0;          // views attempted in the current scan
+int scan_position = 0;      // next position chosen by the planner
+int exports_pending = 0;
+
+// Everything but the exports runs on this queue, in the main thread
+EventQueue event_queue(32 * EVENTS_EVENT_SIZE);
+#if EXPORT_QUEUE_DEPTH > 0
+Thread export_thread(osPriorityBelowNormal, EXPORT_STACK_SIZE);
+Queue<ScanSlot, SCAN_SLOTS> export_queue;
+#endif
+SdUsbConnect *storage;
+
+int turntable_position = 0;     // Current turntable position (step)
 int reconst_index = 1;
 int file_name_index = 1;
 char file_name[32];
 
 /* For viewing image on PC */
 static DisplayApp  display_app;
-
-// Projects a 3D point into camera coordinates
-int projection(double rad, double Xw, double Yw,double Zw, int &u, int &v)
-{
-    // rotate around the Z axis
-    double Xc = cos(rad)*Xw + sin(rad)*Yw;
-    double Yc =-sin(rad)*Xw + cos(rad)*Yw;
-    double Zc = Zw;
-
-    // Perspective projection
-    Yc -= CAMERA_DISTANCE;
-    Zc += CAMERA_OFFSET;
-  
-    u = CAMERA_CENTER_U - (int)((Xc/Yc)*(CAMERA_FX));
-    v = VIDEO_PIXEL_VW - (CAMERA_CENTER_V - (int)((Zc/Yc)*(CAMERA_FY)));
-
-    return (u>0 && u<VIDEO_PIXEL_HW && v>0 && v<VIDEO_PIXEL_VW);
-}
-
-// Voxel based "Shape from silhouette"
-// Only voxels that lie inside all silhouette volumes remain part of the final shape.
-void shape_from_silhouette(double rad) {
-
-    // Take a silhouette
-    cv::Mat img_silhouette = get_silhouette();
-
-    // Saves a silhouette image for dubugging purposes
-    // sprintf(file_name, "/storage/img_%d.bmp", file_name_index);
-    // cv::imwrite(file_name, img_silhouette);
-    // printf("Saved file %s\r\n", file_name);
-
-    // Check each voxels
-    double xx,yy,zz;    // 3D point(x,y,z)
-    int u,v;            // camera coordinates(x,y)
-    int pcd_index=0;
-
-    zz = (-point_cloud.SIZE / 2) * point_cloud.SCALE;
-    for (int z=0; z<point_cloud.SIZE; z++, zz += point_cloud.SCALE) {
-
-        yy = (-point_cloud.SIZE / 2) * point_cloud.SCALE;
-        for (int y=0; y<point_cloud.SIZE; y++, yy += point_cloud.SCALE) {
-
-            xx = (-point_cloud.SIZE / 2) * point_cloud.SCALE;
-            for (int x=0; x<point_cloud.SIZE; x++, xx += point_cloud.SCALE, pcd_index++) {
-                if (point_cloud.get(pcd_index) == 1) {
-                    
-                    // Project a 3D point into camera coordinates
-                    if (projection(rad, xx, yy, zz, u, v)) {
-                        if (img_silhouette.at<unsigned char>(v, u)) {
-                            // Keep the point because it is inside the shilhouette
-                        }
-                        else {
-                            // Delete the point because it is outside the shilhouette
-                            point_cloud.set(pcd_index, 0);
-                        }
-                    } else {
-                        // Delete the point because it is outside the camera image
-                        point_cloud.set(pcd_index, 0);
-                    }
-                }
-            }
-        }
-    }
-}
+Timer preview_timer;
+PreviewScheduler preview(VIDEO_PIXEL_HW, VIDEO_PIXEL_VW, PREVIEW_IDLE_FPS, PREVIEW_SCAN_FPS, PREVIEW_KEEPALIVE_MS);
 
 // Rotates a stepper motor with a A4988 stepper motor driver
 void rotate(int steps) {
+    TRACE_SCOPE("rotate");
     a4988_dir = STEPPER_DIRECTION;
     for (int i=0;i<steps;i++) {
         a4988_step = 1;
@@ -142,70 +259,460 @@ void rotate(int steps) {
         a4988_step = 0;
         wait(STEPPER_WAIT);
     }
+    if (steps > 0) camera_motion_end();
+    turntable_position = (turntable_position + steps) % STEPPER_POSITIONS;
 }
 
-int main() {
-    // Start camera
-    camera_start();
-    led1 = 1;
+// Rotates the turntable to an absolute position (the motor only turns in one direction)
+void rotate_to(int position) {
+    rotate((position - turntable_position + STEPPER_POSITIONS) % STEPPER_POSITIONS);
+}
 
-    // Connect SD & USB
-    SdUsbConnect storage("storage");
+#if CONTINUOUS_ROTATION
+// Timer driven stepping at a constant rate
+#define CONTINUOUS_STEP_US  ((uint32_t)(CONTINUOUS_REVOLUTION * 1000000 / STEPPER_POSITIONS))
+Ticker step_ticker;
+volatile bool step_high = false;
+volatile uint32_t step_count = 0;   // steps since start_rotation()
+volatile uint32_t step_time = 0;    // us_ticker time of the last step
+
+// Ticker handler: each call is one edge of the step signal
+void step_edge() {
+    step_high = !step_high;
+    a4988_step = step_high;
+    if (step_high) {
+        step_time = us_ticker_read();
+        step_count++;
+    }
+}
 
-    // Reset stepper motor
+// Starts turning the turntable
+void start_rotation() {
     a4988_dir = STEPPER_DIRECTION;
+    step_count = 0;
+    step_time = us_ticker_read();
+    step_ticker.attach_us(step_edge, CONTINUOUS_STEP_US / 2);
+}
+
+// Stops the turntable
+void stop_rotation() {
+    step_ticker.detach();
+    step_high = false;
     a4988_step = 0;
+    turntable_position = (turntable_position + step_count) % STEPPER_POSITIONS;
+    camera_motion_end();
+}
+
+// Returns the position (steps since start_rotation(), between steps) at a us_ticker time
+double rotation_position(uint32_t time) {
+    core_util_critical_section_enter();
+    uint32_t count = step_count, last = step_time;
+    core_util_critical_section_exit();
+    return count + (double)(int32_t)(time - last) / CONTINUOUS_STEP_US;
+}
+#endif
+
+// Sends the camera image to PC when the preview scheduler says it is due and has changed
+// (the change is measured on the frame that gets encoded)
+void send_preview() {
+    if (!preview.poll(get_frame_adr(), FRAME_BUFFER_STRIDE, preview_timer.read_ms())) return;
+
+    size_t jpeg_size;
+    if (preview.mode() == PREVIEW_SCAN) {
+        // The view arena is free until scan_view() takes the silhouette
+        view_arena.reset();
+        jpeg_size = create_jpeg_half(view_arena);
+    } else {
+        jpeg_size = create_jpeg();
+    }
+    if (jpeg_size == 0) return;
+    TRACE_SCOPE("send_preview");
+    display_app.SendJpeg(get_jpeg_adr(), jpeg_size);
+}
+
+#if HULL_PREVIEW
+// Sends the height map of the current hull to PC (only when it has changed)
+void send_hull_preview() {
+    if (hull_preview.update(scan->point_cloud) == 0) return;
 
-    while (1) {
-        storage.wait_connect();
+    size_t jpeg_size = create_jpeg_yuv(hull_preview.image(), PREVIEW_WIDTH, PREVIEW_HEIGHT);
+    TRACE_SCOPE("send_preview");
+    display_app.SendJpeg(get_jpeg_adr(), jpeg_size);
+}
+#endif
+
+// Takes a view at the turntable position and carves the point cloud
+// (with CONTINUOUS_ROTATION, from the frame held at a position between two steps)
+CarveStats scan_view(double position) {
+    TRACE_SCOPE("view");
+
+#if CONTINUOUS_ROTATION
+    int moving_frames = 0;
+#else
+    // Wait for a frame taken on a still turntable
+    int moving_frames = camera_wait_still(CAPTURE_SETTLE_MS, CAPTURE_MAX_FRAMES);
+    if (moving_frames >= CAPTURE_MAX_FRAMES) console_printf("View %g: turntable still moving\r\n", position);
+    if (moving_frames < 0) console_printf("View %g: no frame end from the camera, frame not synchronized\r\n", position);
+#endif
+
+#if !HULL_PREVIEW
+    // Send a preview image to PC
+    send_preview();
+#endif
+
+    // Shape from silhouette
+    led_working = 1;
+    double rad = position_angle(position, STEPPER_POSITIONS);
+    int step = (int)position;
+    cv::Rect roi = position == step ? view_roi.roi(step) : grid_roi(camera, rad);
+    CameraModel roi_camera = crop_camera(camera, roi);
+    view_arena.reset();
+    cv::Mat img_silhouette = get_silhouette(view_arena, roi);
+#if DEFERRED_CARVING
+    // Carved after the last view
+    deferred_carver.add_view(img_silhouette, rad, roi);
+    CarveStats stats = { 0, 0, 0 };
+#elif CARVE_MODE == CARVE_FOOTPRINT
+    cv::Mat sat = view_arena.mat(roi.height + 1, roi.width + 1, CV_16U);
+    silhouette_sat(img_silhouette, sat);
+    CarveStats stats = shape_from_silhouette_sat(scan->point_cloud, sat, roi_camera, rad);
+#else
+    CarveStats stats = shape_from_silhouette(scan->point_cloud, img_silhouette, roi_camera, rad);
+#endif
+    scan->view_positions[scan->view_count++] = position;
+#if HULL_PREVIEW
+    send_hull_preview();
+#endif
+    console_printf("View %g: tested %d, removed %d, outside %d, %d moving frames\r\n", position,
+        stats.tested, stats.removed, stats.outside, moving_frames);
 
-        if (button0 == 0) {
-            // Scan 3D object with camera
-            // Repeat taking a image and 3D reconstruction while rotating the turntable.
-            for (int i = 0; i < SILHOUETTE_COUNTS; i++) {
-                // Send a preview image to PC
-                size_t jpeg_size = create_jpeg();
-                display_app.SendJpeg(get_jpeg_adr(), jpeg_size);
+    // Saves a silhouette image for dubugging purposes
+    // sprintf(file_name, "/storage/img_%d.bmp", file_name_index);
+    // cv::imwrite(file_name, img_silhouette);
+    // console_printf("Saved file %s\r\n", file_name);
 
-                // Shape from silhouette
-                led_working = 1;
-                double rad = (double)(2 * 3.14159265258979)*((double)i / SILHOUETTE_COUNTS);
-                shape_from_silhouette(rad);
+    // Save a preview image for dubugging purposes
+    sprintf(file_name, "/storage/img_%d.jpg", file_name_index++);
+    save_image_jpg(file_name); // save as jpeg
+    console_printf("Saved file %s\r\n", file_name);
 
-                // Save a preview image for dubugging purposes
-                sprintf(file_name, "/storage/img_%d.jpg", file_name_index++);
-                save_image_jpg(file_name); // save as jpeg
-                printf("Saved file %s\r\n", file_name);
+    led_working = 0;
+    return stats;
+}
 
-                led_working = 0;
+// Saves the turntable angle (degree) of each view, as read by tools/sfs_batch
+void save_angles(const char* file_name, const ScanSlot &slot) {
+    FILE *fp = fopen(file_name, "w");
+    for (int i = 0; i < slot.view_count; i++) {
+        fprintf(fp, "%g\n", 360.0 * slot.view_positions[i] / STEPPER_POSITIONS);
+    }
+    fclose(fp);
+}
 
-                // Rotate the turntable
-                rotate(STEPPER_STEP_COUNTS * STEPPER_STEP_RESOLUTIONS / SILHOUETTE_COUNTS);
-            }
+// Finalizes and writes a finished scan (in the export thread when EXPORT_QUEUE_DEPTH > 0)
+void export_scan(ScanSlot *slot) {
+    TRACE_SCOPE("export");
+    char path[32];
+
+    // Save the result
+    console_printf("writting...\r\n");
+    led1 = 0;
+
+    // Finalize the result
+    slot->point_cloud.finalize();
+
+    sprintf(path, "/storage/result_%d.xyz", slot->index);
+    slot->point_cloud.save_as_xyz(path);
+
+    // Mesh once for every output
+    MeshSink *sinks[MESH_MAX_SINKS];
+    int sink_count = 0;
+    sprintf(path, "/storage/result_%d.stl", slot->index);
+    StlSink stl_sink(path);
+    sinks[sink_count++] = &stl_sink;
+    // sprintf(path, "/storage/result_%d.ply", slot->index);
+    // PlySink ply_sink(path);
+    // sinks[sink_count++] = &ply_sink;
+#if MESH_STREAM
+    // Also send the mesh to PC as it is generated
+    StreamSink stream_sink(mesh_stream, slot->index);
+    sinks[sink_count++] = &stream_sink;
+#endif
+    StatsSink mesh_stats;
+    sinks[sink_count++] = &mesh_stats;
+#if MESH_DECIMATE
+    // Every output gets the simplified mesh
+    DecimateSink decimate_sink(sinks, sink_count, MESH_DECIMATE_MODE, MESH_DECIMATE_RATIO, MESH_DECIMATE_ERROR,
+        MESH_DECIMATE_MAX_TRIANGLES);
+    sinks[0] = &decimate_sink;
+    sink_count = 1;
+#endif
+    slot->point_cloud.generate_mesh(sinks, sink_count, MESH_METHOD);
+#if MESH_DECIMATE
+    console_printf("Decimated %lu -> %lu triangles%s\r\n",
+        (unsigned long)decimate_sink.input_triangles(), (unsigned long)decimate_sink.output_triangles(),
+        decimate_sink.passed_through() ? " (over MESH_DECIMATE_MAX_TRIANGLES, written without decimation)" : "");
+#endif
+    console_printf("Mesh %d: %lu triangles, area %.0f mm2, volume %.0f mm3\r\n", slot->index,
+        (unsigned long)mesh_stats.triangles, mesh_stats.area, mesh_stats.volume);
+
+    // Volume, size and centroid of the hull for checking the part without the mesh
+    PCD_METRICS metrics;
+    slot->point_cloud.measure(metrics);
+    console_printf("Hull %d: volume %.0f mm3, size %.1f x %.1f x %.1f mm, centroid %.1f %.1f %.1f mm\r\n", slot->index,
+        metrics.volume, metrics.max[0] - metrics.min[0], metrics.max[1] - metrics.min[1], metrics.max[2] - metrics.min[2],
+        metrics.centroid[0], metrics.centroid[1], metrics.centroid[2]);
+    sprintf(path, "/storage/metrics_%d.txt", slot->index);
+    save_metrics(path, metrics, &mesh_stats);
+#if MESH_STREAM
+    if (mesh_stream.ok()) {
+        console_printf("Streamed %lu triangles (%lu frames resent)\r\n",
+            (unsigned long)mesh_stream.triangles(), (unsigned long)mesh_stream.resends());
+    } else {
+        console_printf("Mesh stream failed, is mesh_receiver running?\r\n");
+    }
+#endif
+
+#if GEOMETRY_VALIDATE
+    // Error of the GEOMETRY_SCALAR type against double
+    console_printf("Geometry (%s): %lu/%lu projections on another pixel, %lu/%lu cells differ, vertex error %f, normal error %f\r\n",
+        GEOMETRY_NAME, geometry_error.pixel_mismatches, geometry_error.projections,
+        geometry_error.cell_mismatches, geometry_error.cells,
+        geometry_error.max_vertex_error, geometry_error.max_normal_error);
+#endif
+
+    sprintf(path, "/storage/angles_%d.txt", slot->index);
+    save_angles(path, *slot);
+
+#if TRACE_ENABLE
+    // Save the latency trace (the scan, and the spans of the export thread since it ended)
+    sprintf(path, "/storage/trace_%d.json", slot->index);
+    slot->trace_count += trace_copy(slot->trace_export, trace_position(), slot->trace_events + slot->trace_count,
+        TRACE_BUFFER_SIZE - slot->trace_count, true);
+    trace_save_json(path, slot->trace_events, slot->trace_count);
+    console_printf("Saved file %s\r\n", path);
+#endif
+
+    slot->point_cloud.clear();
+    led1 = 1;
+    console_printf("finish %d\r\n", slot->index);
+#if MEMPROF_ENABLE
+    // Memory use since the previous report (the next scan where they overlap)
+    console_lock();
+    memprof_report(stdout);
+    console_unlock();
+    memprof_clear();
+#endif
+}
 
-            // Save the result
-            cout << "writting..." << endl;
-            led_working = 1;
+// Returns true when the next slot can take a scan
+bool slot_ready() {
+#if GEOMETRY_VALIDATE
+    // The geometry error is global, so a scan must not overlap the export of another
+    if (exports_pending > 0) return false;
+#endif
+    return !scan_slots[reconst_index % SCAN_SLOTS].busy;
+}
 
-            // Finalize the result
-            point_cloud.finalize();
+void scan_next();
+
+// Starts a scan in the next slot
+void start_scan() {
+    scan = &scan_slots[reconst_index % SCAN_SLOTS];
+    scan->busy = true;
+    scan->index = reconst_index++;
+    scan->view_count = 0;
+#if TRACE_ENABLE
+    scan->begin = trace_now();
+    scan->trace_first = trace_position();
+#endif
+    scan_state = STATE_SCANNING;
+    scan_step = 0;
+    scan_position = 0;
+    preview.set_mode(PREVIEW_SCAN);
+
+    // Scan 3D object with camera
+    // Repeat taking a image and 3D reconstruction while rotating the turntable.
+    convergence.clear();
+#if GEOMETRY_VALIDATE
+    geometry_error_clear();
+#endif
+#if DEFERRED_CARVING
+    deferred_carver.clear();
+#endif
+#if HULL_PREVIEW
+    hull_preview.clear();
+#endif
+#if VIEW_PLANNING
+    planner.clear();
+#endif
+    view_arena.clear_stats();
+    event_queue.call(scan_next);
+}
 
-            sprintf(file_name, "/storage/result_%d.xyz", reconst_index);
-            point_cloud.save_as_xyz(file_name);
-            sprintf(file_name, "/storage/result_%d.stl", reconst_index);
-            point_cloud.save_as_stl(file_name);
-            // sprintf(file_name, "/storage/result_%d.ply", reconst_index);
-            // point_cloud.save_as_ply(file_name);
+// Frees the slot of an exported scan
+void export_done(ScanSlot *slot) {
+    slot->busy = false;
+    exports_pending--;
+    if (scan_state == STATE_IDLE && exports_pending == 0) {
+        console_printf("Preview: %lu sent, %lu unchanged skipped\r\n",
+            (unsigned long)preview.sent(), (unsigned long)preview.skipped());
+        preview.set_mode(PREVIEW_IDLE);
+    }
+    if (scan_state == STATE_WAITING && slot_ready()) start_scan();
+}
 
-            reconst_index++;
+#if EXPORT_QUEUE_DEPTH > 0
+// Exports the finished scans in order, below the priority of scanning
+// (it mostly runs while the scan waits for the stepper motor and the camera)
+void export_main() {
+    while (true) {
+        osEvent event = export_queue.get();
+        if (event.status != osEventMessage) continue;
+        ScanSlot *slot = (ScanSlot *)event.value.p;
+        export_scan(slot);
+        // The slot stays busy until export_done runs, so retry while the queue is out of memory
+        while (event_queue.call(export_done, slot) == 0) {
+            Thread::wait(1);
+        }
+    }
+}
+#endif
+
+// Ends the scan and hands it to the export
+void finish_scan() {
+    rotate_to(0);
+
+#if DEFERRED_CARVING
+    // Carve with all views in one pass
+    led_working = 1;
+    CarveStats stats = deferred_carver.carve(scan->point_cloud);
+    console_printf("Carved %d views: tested %d, removed %d, outside %d, %ld lookups\r\n", deferred_carver.views(),
+        stats.tested, stats.removed, stats.outside, deferred_carver.lookups());
+#if HULL_PREVIEW
+    send_hull_preview();
+#endif
+    led_working = 0;
+#endif
+
+#if TRACE_ENABLE
+    trace_record("scan", scan->begin, trace_now());
+    // Copy the spans of the scan before the next scan overwrites them (exports of
+    // earlier scans record on their own thread)
+    scan->trace_export = trace_position();
+    scan->trace_count = trace_copy(scan->trace_first, scan->trace_export, scan->trace_events, TRACE_BUFFER_SIZE, true);
+#endif
+    // Views that did not fit in CAMERA_ARENA_SIZE used the heap
+    console_printf("Arena: peak %lu of %lu bytes, %u overflows\r\n", (unsigned long)view_arena.peak(),
+        (unsigned long)view_arena.capacity(), view_arena.overflows());
+    scan_state = STATE_IDLE;
+    exports_pending++;
+#if EXPORT_QUEUE_DEPTH > 0
+    // A free slot always has room in the queue, so this does not block. Light
+    // previews until the export is done.
+    export_queue.put(scan);
+#else
+    // No previews until it is written
+    preview.set_mode(PREVIEW_PAUSED);
+    export_scan(scan);
+    export_done(scan);
+#endif
+}
 
-            led_working = 0;
-            cout << "finish" << endl;
-            point_cloud.clear();
+// Takes the next view of the current scan, or ends it
+void scan_next() {
+    bool done = scan_step >= SILHOUETTE_COUNTS;
+#if VIEW_PLANNING
+    // The planner chooses each next view until no view can carve enough voxels
+    done = done || scan_position < 0;
+    if (!done) {
+        rotate_to(scan_position);
+        CarveStats stats = scan_view(scan_position);
+        done = CONVERGENCE_STOP && convergence.update(stats);
+        if (!done) {
+            planner.add_view(scan_position);
+            scan_position = planner.next_view(scan->point_cloud, scan_position, VIEW_PLANNING_MIN_SCORE);
         }
+    }
+#elif CONTINUOUS_ROTATION
+    // The turntable keeps turning. Each view is carved from the first frame past its
+    // share of the revolution, at the position of the middle of the frame.
+    if (!done) {
+        if (scan_step == 0) start_rotation();
+        double target = (double)scan_step * STEPPER_POSITIONS / SILHOUETTE_COUNTS;
+        double position;
+        do {
+            position = rotation_position(camera_wait_frame() - CONTINUOUS_LATENCY_US);
+        } while (position < target);
+        camera_hold_frame();
+        scan_view(fmod(turntable_position + position, STEPPER_POSITIONS));
+        camera_release_frame();
+
+        // Views whose share has already passed are skipped rather than taken late
+        int next = (int)(position * SILHOUETTE_COUNTS / STEPPER_POSITIONS) + 1;
+        if (next > scan_step + 1) scan_step = next - 1;
+        done = scan_step + 1 >= SILHOUETTE_COUNTS;
+        if (done) stop_rotation();
+    }
+#else
+    if (!done) {
+        // Rotate the turntable
+        int view = CONVERGENCE_STOP ? interleaved_view(scan_step, SILHOUETTE_COUNTS) : scan_step;
+        rotate_to(view * STEPPER_POSITIONS / SILHOUETTE_COUNTS);
+
+        CarveStats stats = scan_view(turntable_position);
+        done = CONVERGENCE_STOP && convergence.update(stats);
+    }
+#endif
+    scan_step++;
+
+    // One event per view lets export completions through between views
+    if (done) {
+        finish_scan();
+    } else {
+        event_queue.call(scan_next);
+    }
+}
 
-        // Send a preview image to PC
-        size_t jpeg_size = create_jpeg();
-        display_app.SendJpeg(get_jpeg_adr(), jpeg_size);
+// Checks the button and sends previews while no scan is running
+void poll() {
+    if (scan_state != STATE_IDLE) return;
+    storage->wait_connect();
+
+    if (button0 == 0) {
+        if (slot_ready()) {
+            start_scan();
+        } else {
+            console_printf("Waiting for export...\r\n");
+            scan_state = STATE_WAITING;
+        }
+        return;
     }
+
+    // Send a preview image to PC when one is due
+    send_preview();
+}
+
+int main() {
+    // Start camera
+    camera_start();
+    preview_timer.start();
+    led1 = 1;
+
+    MEMPROF_STATIC("scan_slots", sizeof(scan_slots));
+    MEMPROF_STATIC("view_arena", sizeof(view_arena_buffer));
+
+    // Connect SD & USB
+    SdUsbConnect storage_connect("storage");
+    storage = &storage_connect;
+
+    // Reset stepper motor
+    a4988_dir = STEPPER_DIRECTION;
+    a4988_step = 0;
+
+#if EXPORT_QUEUE_DEPTH > 0
+    export_thread.start(export_main);
+#endif
+    event_queue.call_every(PREVIEW_POLL_MS, poll);
+    event_queue.dispatch_forever();
 }
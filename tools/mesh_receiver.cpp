@@ -0,0 +1,297 @@
+/*
+** Mesh stream receiver (host tool)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+// Receives the meshes streamed by the scanner (MESH_STREAM in main.cpp) or by
+// sfs_batch -s, and writes them as mesh_N.stl, .ply or .obj (N: scan index).
+//
+// The file grows as triangle frames arrive, so a mesh can be opened before the
+// scanner has finished meshing; the triangle count in the header is written
+// when the stream ends. Text that is not part of a frame (the scanner's console
+// output on the same serial port) is printed as is.
+//
+// Usage:
+//   mesh_receiver -d /dev/ttyACM0 -b 921600     (scanner on the USB serial)
+//   mesh_receiver -p 5555                       (sfs_batch -s localhost:5555)
+//
+// Build:
+//   g++ -std=c++11 -O2 -pthread -I../libs mesh_receiver.cpp ../libs/mesh_sink.cpp
+//       ../libs/mesh_stream.cpp ../libs/trace.cpp ../libs/mem_profile.cpp -o mesh_receiver
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <string>
+#include <thread>
+#include "mesh_sink.hpp"
+
+using namespace std;
+
+struct Options {
+    string dir;
+    string format;      // stl, ply or obj
+};
+
+static Options options;
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static float get_float(const uint8_t *p) {
+    uint32_t bits = get_u32(p);
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Opens the sink of a new mesh
+static MeshSink* open_mesh(uint32_t index, string &path) {
+    char name[64];
+    snprintf(name, sizeof(name), "/mesh_%u.%s", index, options.format.c_str());
+    path = options.dir + name;
+
+    MeshSink *sink;
+    if (options.format == "ply") {
+        sink = new PlySink(path.c_str());
+    } else if (options.format == "obj") {
+        sink = new ObjSink(path.c_str());
+    } else {
+        sink = new StlSink(path.c_str());
+    }
+    if (!sink->begin()) {
+        delete sink;
+        return NULL;
+    }
+    sink->flush();
+    return sink;
+}
+
+// Passes a frame of triangles to the sink
+static void add_triangles(MeshSink *sink, const uint8_t *payload, int n) {
+    for (int i = 0; i < n; i++, payload += STREAM_TRIANGLE_SIZE) {
+        XYZ normal;
+        TRIANGLE triangle;
+        normal.x = get_float(payload);
+        normal.y = get_float(payload + 4);
+        normal.z = get_float(payload + 8);
+        for (int j = 0; j < 3; j++) {
+            triangle.p[j].x = get_float(payload + 12 + j * 12);
+            triangle.p[j].y = get_float(payload + 16 + j * 12);
+            triangle.p[j].z = get_float(payload + 20 + j * 12);
+        }
+        sink->add(normal, triangle);
+    }
+    sink->flush();
+}
+
+// Answers a frame (ack or nak)
+static void reply(StreamPort &port, uint8_t type, uint8_t sequence) {
+    uint8_t frame[STREAM_MAX_FRAME];
+    size_t size = stream_frame(frame, type, sequence, NULL, 0);
+    port.write(frame, size);
+}
+
+// Receives streams from a port until it is closed
+static void receive(int fd, const string &peer) {
+    FdStreamPort port(fd);
+    FrameParser parser;
+    MeshSink *mesh = NULL;
+    string path;
+    uint32_t received = 0;
+    uint8_t expected = 0;       // next sequence in order
+    int nak_sent = -1;          // expected sequence already asked for (one NAK per gap)
+    uint8_t buffer[4096];
+
+    for (;;) {
+        int n = port.read(buffer, sizeof(buffer), 1000);
+        if (n < 0) break;
+
+        for (int i = 0; i < n; i++) {
+            int result = parser.feed(buffer[i]);
+            if (result == PARSE_TEXT) {
+                putchar(buffer[i]);
+                continue;
+            }
+            if (result == PARSE_ERROR) {
+                if (nak_sent != expected) reply(port, STREAM_NAK, expected);
+                nak_sent = expected;
+                continue;
+            }
+            if (result != PARSE_FRAME) continue;
+
+            // A new stream always starts at sequence 0 (unless it is a resent copy of the last frame)
+            if (parser.type == STREAM_BEGIN && parser.sequence == 0 && expected != 1) expected = 0;
+
+            if (parser.sequence != expected) {
+                // Duplicate (ack again) or a gap (ask for a resend)
+                if ((uint8_t)(expected - parser.sequence) <= STREAM_WINDOW) {
+                    reply(port, STREAM_ACK, expected - 1);
+                } else if (nak_sent != expected) {
+                    reply(port, STREAM_NAK, expected);
+                    nak_sent = expected;
+                }
+                continue;
+            }
+
+            switch (parser.type) {
+            case STREAM_BEGIN:
+                delete mesh;    // an unfinished mesh is left as is
+                mesh = open_mesh(get_u32(parser.payload), path);
+                received = 0;
+                if (mesh) {
+                    printf("%s: receiving %s\n", peer.c_str(), path.c_str());
+                } else {
+                    fprintf(stderr, "%s: cannot write %s\n", peer.c_str(), path.c_str());
+                }
+                break;
+            case STREAM_TRIANGLES:
+                if (mesh) {
+                    add_triangles(mesh, parser.payload, parser.length / STREAM_TRIANGLE_SIZE);
+                    received += parser.length / STREAM_TRIANGLE_SIZE;
+                }
+                break;
+            case STREAM_END:
+                if (mesh) {
+                    uint32_t triangles = get_u32(parser.payload);
+                    bool ok = mesh->end() && received == triangles;
+                    printf("%s: %s, %u triangles%s\n", peer.c_str(), path.c_str(), triangles,
+                           ok ? "" : " (incomplete)");
+                    delete mesh;
+                    mesh = NULL;
+                }
+                break;
+            }
+            reply(port, STREAM_ACK, expected);
+            expected++;
+        }
+        fflush(stdout);
+    }
+    delete mesh;
+    close(fd);
+}
+
+// Opens a serial device in raw mode
+static int open_serial(const char *device, int baud) {
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0) return -1;
+
+    struct termios tio;
+    tcgetattr(fd, &tio);
+    cfmakeraw(&tio);
+    speed_t speed;
+    switch (baud) {
+    case 9600: speed = B9600; break;
+    case 115200: speed = B115200; break;
+    case 230400: speed = B230400; break;
+    case 460800: speed = B460800; break;
+    default: speed = B921600; break;
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    tcsetattr(fd, TCSANOW, &tio);
+    return fd;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -d dev    serial device of the scanner (e.g. /dev/ttyACM0)\n"
+        "  -b baud   serial baud rate (default: 921600, see MESH_STREAM_BAUD)\n"
+        "  -p port   listen on a TCP port instead (for sfs_batch -s)\n"
+        "  -o dir    output directory (default: .)\n"
+        "  -f fmt    output format, stl, ply or obj (default: stl)\n",
+        prog);
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = NULL;
+    int baud = 921600;
+    int port = 0;
+    options.dir = ".";
+    options.format = "stl";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:b:p:o:f:")) != -1) {
+        switch (opt) {
+        case 'd': device = optarg; break;
+        case 'b': baud = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'o': options.dir = optarg; break;
+        case 'f': options.format = optarg; break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (options.format != "stl" && options.format != "ply" && options.format != "obj") {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (device) {
+        int fd = open_serial(device, baud);
+        if (fd < 0) {
+            fprintf(stderr, "cannot open %s\n", device);
+            return 1;
+        }
+        receive(fd, device);
+        return 0;
+    }
+    if (port <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 8) != 0) {
+        fprintf(stderr, "cannot listen on port %d\n", port);
+        return 1;
+    }
+    printf("listening on port %d\n", port);
+
+    // One thread per connection (sfs_batch streams scans in parallel)
+    for (;;) {
+        int fd = accept(server, NULL, NULL);
+        if (fd < 0) continue;
+        char peer[32];
+        snprintf(peer, sizeof(peer), "connection %d", fd);
+        thread(receive, fd, string(peer)).detach();
+    }
+}
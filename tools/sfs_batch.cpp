@@ -0,0 +1,687 @@
+/*
+** Batch reconstruction job runner (host tool)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+// Re-processes recorded scans on a PC.
+//
+// Each scan directory holds the img_N.jpg frames saved by the scanner and an
+// optional angles.txt (one turntable angle in degrees per frame, in frame
+// order, as saved by the scanner in angles_N.txt). Without angles.txt the
+// frames are treated as equally spaced views.
+//
+// Every scan is split into jobs (silhouette -> carve per view, then finalize,
+// then the xyz export and one meshing pass for all mesh formats and the
+// metrics.txt measurements) which run on
+// a pool of worker threads, bounded by the worker count and a memory budget.
+//
+// Build:
+//   g++ -std=c++11 -O2 -pthread -I../libs -I/usr/include/opencv4
+//       -I/usr/include/opencv4/opencv2 sfs_batch.cpp ../libs/reconstruction.cpp
+//       ../libs/tinypcl.cpp ../libs/marchingcubes.cpp ../libs/mesh_sink.cpp
+//       ../libs/mesh_stream.cpp ../libs/geometry.cpp ../libs/carve_kernel.cpp ../libs/trace.cpp ../libs/mem_profile.cpp
+//       ../libs/parallel_mesher.cpp ../libs/mesh_decimator.cpp
+//       -lopencv_core -lopencv_imgproc -lopencv_imgcodecs -o sfs_batch
+// Add -DGEOMETRY_SCALAR=1 (float) or 2 (Q16.16) to select the geometry scalar type
+// (float also carves with the SSE kernel, or AVX with -mavx). -DMEMPROF_ENABLE=1 prints
+// the heap use of each pipeline stage at the end (all scans and workers together).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "reconstruction.hpp"
+#include "parallel_mesher.hpp"
+#include "mesh_decimator.hpp"
+#include "trace.hpp"
+#include "mem_profile.hpp"
+
+using namespace std;
+
+// Default camera parameters (same as main.cpp)
+#define CAMERA_DISTANCE 115
+#define CAMERA_OFFSET   0
+#define CAMERA_CENTER_U 320
+#define CAMERA_CENTER_V 240
+#define CAMERA_FX       370.0
+#define CAMERA_FY       370.0
+
+// Estimated frame size, used for memory accounting before a frame is decoded
+#define FRAME_WIDTH     640
+#define FRAME_HEIGHT    480
+
+enum Stage { STAGE_SILHOUETTE, STAGE_CARVE, STAGE_FINALIZE, STAGE_EXPORT };
+static const char* stage_names[] = { "silhouette", "carve", "finalize", "export" };
+
+struct Scan {
+    string dir;
+    vector<string> frames;
+    vector<double> angles;          // rad
+    vector<cv::Mat> silhouettes;    // region of interest of each view only
+    vector<CameraModel> cameras;    // camera of each silhouette (cropped to the region)
+    PointCloud *point_cloud;
+    bool carving;                   // views are carved one at a time
+    int jobs_left;                  // scan is released when this reaches 0
+    bool failed;
+    double start_ms, end_ms;
+    long long voxels;
+    PCD_METRICS metrics;            // of the finalized grid
+};
+
+struct Job {
+    string name;
+    int scan;
+    Stage stage;
+    int view;
+    function<bool(Job&)> run;
+    vector<int> dependents;
+    int pending;                    // number of unfinished dependencies
+    size_t reserve;                 // bytes held while running
+    size_t retain;                  // bytes still held after finishing
+    int release_by;                 // job that releases the retained bytes
+    size_t released;                // bytes released when this job finishes
+    bool done, ok, skipped;
+    int worker;
+    double start_ms, end_ms;
+    string output;
+};
+
+struct Options {
+    CameraModel camera;
+    int workers;
+    int mesh_threads;               // threads meshing one scan
+    size_t memory_budget;
+    int carve_mode;
+    int mesh_method;
+    int decimate_mode;              // -1: off
+    float decimate_ratio, decimate_error;
+    bool xyz, stl, ply, obj, metrics;
+    string stream;                  // host:port of tools/mesh_receiver
+    string report;
+    string trace;
+};
+
+static vector<Scan*> scans;
+static vector<Job> jobs;
+static Options options;
+
+static mutex sched_lock;
+static condition_variable sched_cond;
+static size_t memory_used = 0;
+static int jobs_running = 0;
+static int jobs_remaining = 0;
+static chrono::steady_clock::time_point t0;
+
+static double now_ms() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - t0).count();
+}
+
+static size_t grid_bytes() {
+    return sizeof(PointCloud);
+}
+
+// Connects to host:port, returns a socket or -1
+static int connect_to(const string &address) {
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) return -1;
+    string host = address.substr(0, colon);
+    string port = address.substr(colon + 1);
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) return -1;
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd >= 0 && connect(fd, res->ai_addr, res->ai_addrlen) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static long file_size(const string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return -1;
+    return (long)st.st_size;
+}
+
+// Lists img_N.jpg frames of a scan directory in N order
+static bool list_frames(const string &dir, vector<string> &frames) {
+    DIR *dp = opendir(dir.c_str());
+    if (dp == NULL) return false;
+
+    vector<pair<int, string> > found;
+    struct dirent *ent;
+    while ((ent = readdir(dp)) != NULL) {
+        int n;
+        char tail[8];
+        if (sscanf(ent->d_name, "img_%d.%7s", &n, tail) == 2 && strcmp(tail, "jpg") == 0) {
+            found.push_back(make_pair(n, dir + "/" + ent->d_name));
+        }
+    }
+    closedir(dp);
+
+    sort(found.begin(), found.end());
+    for (size_t i = 0; i < found.size(); i++) frames.push_back(found[i].second);
+    return !frames.empty();
+}
+
+// Reads angles.txt (degrees), or spaces the views equally
+static bool load_angles(Scan &scan) {
+    string path = scan.dir + "/angles.txt";
+    FILE *fp = fopen(path.c_str(), "r");
+    if (fp == NULL) {
+        for (size_t i = 0; i < scan.frames.size(); i++) {
+            scan.angles.push_back(view_angle((int)i, (int)scan.frames.size()));
+        }
+        return true;
+    }
+
+    double deg;
+    while (fscanf(fp, "%lf", &deg) == 1) {
+        scan.angles.push_back(deg * 3.14159265358979 / 180.0);
+    }
+    fclose(fp);
+
+    if (scan.angles.size() != scan.frames.size()) {
+        fprintf(stderr, "%s: %d angles for %d frames\n", path.c_str(), (int)scan.angles.size(), (int)scan.frames.size());
+        return false;
+    }
+    return true;
+}
+
+static int add_job(int scan, Stage stage, int view, const string &name, function<bool(Job&)> run) {
+    Job job;
+    job.name = name;
+    job.scan = scan;
+    job.stage = stage;
+    job.view = view;
+    job.run = run;
+    job.pending = 0;
+    job.reserve = 0;
+    job.retain = 0;
+    job.release_by = -1;
+    job.released = 0;
+    job.done = job.ok = job.skipped = false;
+    job.worker = -1;
+    job.start_ms = job.end_ms = 0;
+    jobs.push_back(job);
+    return (int)jobs.size() - 1;
+}
+
+static void depends(int job, int on) {
+    jobs[on].dependents.push_back(job);
+    jobs[job].pending++;
+}
+
+// Builds the job graph of a scan
+static void add_scan_jobs(int s) {
+    Scan &scan = *scans[s];
+    size_t frame_bytes = (size_t)FRAME_WIDTH * FRAME_HEIGHT;
+    char name[64];
+
+    int finalize = -1;
+    vector<int> carves;
+    for (size_t i = 0; i < scan.frames.size(); i++) {
+        snprintf(name, sizeof(name), "silhouette_%d", (int)i);
+        int sil = add_job(s, STAGE_SILHOUETTE, (int)i, name, [](Job &job) {
+            Scan &scan = *scans[job.scan];
+            cv::Mat img = cv::imread(scan.frames[job.view], cv::IMREAD_COLOR);
+            if (img.empty()) {
+                job.output = "cannot read " + scan.frames[job.view];
+                return false;
+            }
+            // Only the region the grid projects into can be inside the silhouette
+            CameraModel camera = options.camera;
+            camera.width = img.cols;
+            camera.height = img.rows;
+            cv::Rect roi = grid_roi(camera, scan.angles[job.view]);
+            scan.cameras[job.view] = crop_camera(camera, roi);
+            silhouette_from_bgr(img(roi), scan.silhouettes[job.view]);
+            return true;
+        });
+        // BGR + HSV while running, the silhouette stays until it is carved
+        jobs[sil].reserve = frame_bytes * 7;
+        jobs[sil].retain = frame_bytes;
+
+        snprintf(name, sizeof(name), "carve_%d", (int)i);
+        int carve = add_job(s, STAGE_CARVE, (int)i, name, [](Job &job) {
+            Scan &scan = *scans[job.scan];
+            cv::Mat &img_silhouette = scan.silhouettes[job.view];
+            const CameraModel &camera = scan.cameras[job.view];
+            if (options.carve_mode == CARVE_FOOTPRINT) {
+                cv::Mat sat;
+                silhouette_sat(img_silhouette, sat);
+                shape_from_silhouette_sat(*scan.point_cloud, sat, camera, scan.angles[job.view]);
+            } else {
+                shape_from_silhouette(*scan.point_cloud, img_silhouette, camera, scan.angles[job.view]);
+            }
+            img_silhouette.release();
+            return true;
+        });
+        depends(carve, sil);
+        // summed-area table, 16 bits per pixel
+        jobs[carve].reserve = options.carve_mode == CARVE_FOOTPRINT ? frame_bytes * 2 : 0;
+        jobs[sil].release_by = carve;
+        carves.push_back(carve);
+    }
+
+    finalize = add_job(s, STAGE_FINALIZE, -1, "finalize", [](Job &job) {
+        Scan &scan = *scans[job.scan];
+        scan.point_cloud->finalize();
+        scan.point_cloud->measure(scan.metrics);
+        scan.voxels = scan.metrics.voxels;
+        return true;
+    });
+    for (size_t i = 0; i < carves.size(); i++) depends(finalize, carves[i]);
+
+    // Exports only read the grid, so they run concurrently
+    if (options.xyz) {
+        string path = scan.dir + "/result.xyz";
+        int job = add_job(s, STAGE_EXPORT, -1, "export_xyz", [path](Job &job) {
+            Scan &scan = *scans[job.scan];
+            scan.point_cloud->save_as_xyz(path.c_str());
+            long size = file_size(path);
+            if (size < 0) {
+                job.output = "cannot write " + path;
+                return false;
+            }
+            char buf[32];
+            snprintf(buf, sizeof(buf), " (%ld bytes)", size);
+            job.output = path + buf;
+            return true;
+        });
+        depends(job, finalize);
+    }
+
+    // One marching cubes pass feeds every mesh format (and the mesh area of the metrics)
+    if (options.stl || options.ply || options.obj || options.metrics || !options.stream.empty()) {
+        int job = add_job(s, STAGE_EXPORT, -1, "export_mesh", [](Job &job) {
+            Scan &scan = *scans[job.scan];
+            vector<unique_ptr<MeshSink> > owned;
+            vector<MeshSink*> sinks;
+            string base = scan.dir + "/result.";
+            if (options.stl) owned.emplace_back(new StlSink((base + "stl").c_str()));
+            if (options.ply) owned.emplace_back(new PlySink((base + "ply").c_str()));
+            if (options.obj) owned.emplace_back(new ObjSink((base + "obj").c_str()));
+
+            int fd = -1;
+            unique_ptr<FdStreamPort> port;
+            unique_ptr<MeshStream> stream;
+            if (!options.stream.empty()) {
+                fd = connect_to(options.stream);
+                if (fd < 0) {
+                    job.output = "cannot connect to " + options.stream;
+                    return false;
+                }
+                port.reset(new FdStreamPort(fd));
+                stream.reset(new MeshStream(*port));
+                owned.emplace_back(new StreamSink(*stream, job.scan));
+            }
+
+            StatsSink stats;
+            for (size_t i = 0; i < owned.size(); i++) sinks.push_back(owned[i].get());
+            sinks.push_back(&stats);
+            unique_ptr<DecimateSink> decimate;
+            if (options.decimate_mode >= 0) {
+                decimate.reset(new DecimateSink(sinks.data(), (int)sinks.size(), options.decimate_mode,
+                                                options.decimate_ratio, options.decimate_error, (size_t)-1));
+                sinks.assign(1, decimate.get());
+            }
+            bool ok = generate_mesh_parallel(*scan.point_cloud, sinks.data(), (int)sinks.size(), options.mesh_threads,
+                                             options.mesh_method);
+            if (fd >= 0) close(fd);
+
+            char buf[128];
+            snprintf(buf, sizeof(buf), "%u triangles, area %.0f mm2, volume %.0f mm3", stats.triangles, stats.area, stats.volume);
+            job.output = buf;
+            if (decimate) {
+                snprintf(buf, sizeof(buf), " (decimated from %u)", decimate->input_triangles());
+                job.output += buf;
+            }
+            if (!ok) job.output += (stream && !stream->ok()) ? ", stream to " + options.stream + " failed" : ", cannot write " + base + "*";
+            if (options.metrics && !save_metrics((scan.dir + "/metrics.txt").c_str(), scan.metrics, &stats)) {
+                job.output += ", cannot write " + scan.dir + "/metrics.txt";
+                ok = false;
+            }
+            return ok;
+        });
+        depends(job, finalize);
+    }
+}
+
+// Marks the job and everything depending on it as skipped
+static void skip_dependents(int id) {
+    for (size_t i = 0; i < jobs[id].dependents.size(); i++) {
+        int d = jobs[id].dependents[i];
+        if (!jobs[d].skipped) {
+            jobs[d].skipped = true;
+            jobs[d].done = true;
+            jobs_remaining--;
+            scans[jobs[d].scan]->jobs_left--;
+            skip_dependents(d);
+        }
+    }
+}
+
+// Picks the runnable job with the smallest id (older scans first) that fits
+// in the memory budget. Called with sched_lock held.
+static int pick_job(size_t &reserved) {
+    for (size_t i = 0; i < jobs.size(); i++) {
+        Job &job = jobs[i];
+        if (job.done || job.worker >= 0 || job.pending > 0) continue;
+
+        Scan &scan = *scans[job.scan];
+        if (job.stage == STAGE_CARVE && scan.carving) continue;
+
+        size_t need = job.reserve;
+        if (scan.point_cloud == NULL) need += grid_bytes();
+
+        // Always let one job run, otherwise a small budget would stall
+        if (jobs_running > 0 && memory_used + need > options.memory_budget) continue;
+
+        reserved = need;
+        return (int)i;
+    }
+    return -1;
+}
+
+static void worker_main(int worker) {
+    unique_lock<mutex> lock(sched_lock);
+    while (jobs_remaining > 0) {
+        size_t reserved = 0;
+        int id = pick_job(reserved);
+        if (id < 0) {
+            sched_cond.wait(lock);
+            continue;
+        }
+
+        Job &job = jobs[id];
+        Scan &scan = *scans[job.scan];
+        job.worker = worker;
+        memory_used += reserved;
+        jobs_running++;
+        if (job.stage == STAGE_CARVE) scan.carving = true;
+        if (scan.point_cloud == NULL) {
+            scan.point_cloud = new PointCloud();
+            scan.start_ms = now_ms();
+        }
+
+        lock.unlock();
+        job.start_ms = now_ms();
+        bool ok = job.run(job);
+        job.end_ms = now_ms();
+        lock.lock();
+
+        job.ok = ok;
+        job.done = true;
+        jobs_running--;
+        jobs_remaining--;
+        if (job.stage == STAGE_CARVE) scan.carving = false;
+        memory_used -= job.reserve - job.retain;
+        if (job.release_by >= 0) jobs[job.release_by].released += job.retain;
+        memory_used -= job.released;
+
+        if (ok) {
+            for (size_t i = 0; i < job.dependents.size(); i++) jobs[job.dependents[i]].pending--;
+        } else {
+            scan.failed = true;
+            skip_dependents(id);
+            // Retained bytes of skipped consumers are never released otherwise
+            if (job.release_by >= 0) memory_used -= job.retain;
+        }
+
+        scan.jobs_left--;
+        if (scan.jobs_left == 0) {
+            scan.end_ms = now_ms();
+            delete scan.point_cloud;
+            memory_used -= grid_bytes();
+        }
+
+        printf("[%8.1f ms] %s %s %s %s\n", job.end_ms, scan.dir.c_str(), job.name.c_str(),
+               ok ? "ok" : "FAILED", job.output.c_str());
+        sched_cond.notify_all();
+    }
+    sched_cond.notify_all();
+}
+
+// Writes per-job timing and per-scan output summaries
+static void write_report(const string &path) {
+    FILE *fp = fopen(path.c_str(), "w");
+    if (fp == NULL) {
+        fprintf(stderr, "cannot write %s\n", path.c_str());
+        return;
+    }
+
+    fprintf(fp, "scan,job,stage,view,worker,start_ms,end_ms,duration_ms,status,output\n");
+    for (size_t i = 0; i < jobs.size(); i++) {
+        Job &job = jobs[i];
+        const char *status = job.skipped ? "skipped" : (job.ok ? "ok" : "failed");
+        fprintf(fp, "%s,%s,%s,%d,%d,%.3f,%.3f,%.3f,%s,%s\n",
+                scans[job.scan]->dir.c_str(), job.name.c_str(), stage_names[job.stage], job.view,
+                job.worker, job.start_ms, job.end_ms, job.end_ms - job.start_ms, status, job.output.c_str());
+    }
+    fclose(fp);
+
+    printf("\nscan, frames, voxels, time (ms), status\n");
+    for (size_t s = 0; s < scans.size(); s++) {
+        Scan &scan = *scans[s];
+        printf("%s, %d, %lld, %.1f, %s\n", scan.dir.c_str(), (int)scan.frames.size(), scan.voxels,
+               scan.end_ms - scan.start_ms, scan.failed ? "FAILED" : "ok");
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options] scan_dir...\n"
+        "  -l file   read scan directories from file (one per line)\n"
+        "  -j n      number of worker threads (default: number of cores)\n"
+        "  -p n      threads meshing each scan, on top of the worker feeding the sinks (default: workers / scans)\n"
+        "  -m mb     memory budget in MB (default: 512)\n"
+        "  -r file   per-job report (default: batch_report.csv)\n"
+        "  -f fmts   export formats, comma separated xyz,stl,ply,obj,metrics (default: xyz,stl,metrics)\n"
+        "  -c mode   carving mode, center or footprint (default: center)\n"
+        "  -e method surface extraction, cubes (marching cubes) or nets (surface nets) (default: cubes)\n"
+        "  -z mode   simplify the mesh before export, cluster:mm (vertex clustering on mm cells)\n"
+        "            or quadric:ratio[:mm] (edge collapse to ratio of the triangles, error up to mm, default 1)\n"
+        "  -s addr   also stream each mesh to tools/mesh_receiver at host:port\n"
+        "  -t file   save a Chrome trace of the pipeline stages (needs -DTRACE_ENABLE=1)\n"
+        "  -d mm     camera distance (default: %d)\n"
+        "  -o mm     camera height offset (default: %d)\n"
+        "  -u px -v px   optical center (default: %d %d)\n"
+        "  -x px -y px   focal length (default: %g %g)\n",
+        prog, CAMERA_DISTANCE, CAMERA_OFFSET, CAMERA_CENTER_U, CAMERA_CENTER_V, CAMERA_FX, CAMERA_FY);
+}
+
+int main(int argc, char *argv[]) {
+    CameraModel camera = {
+        CAMERA_DISTANCE, CAMERA_OFFSET,
+        CAMERA_CENTER_U, CAMERA_CENTER_V, CAMERA_FX, CAMERA_FY,
+        FRAME_WIDTH, FRAME_HEIGHT
+    };
+    options.camera = camera;
+    options.workers = (int)thread::hardware_concurrency();
+    options.mesh_threads = 0;
+    options.memory_budget = (size_t)512 * 1024 * 1024;
+    options.carve_mode = CARVE_CENTER;
+    options.mesh_method = MESH_MARCHING_CUBES;
+    options.decimate_mode = -1;
+    options.xyz = options.stl = options.metrics = true;
+    options.ply = options.obj = false;
+    options.report = "batch_report.csv";
+
+    vector<string> dirs;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:j:p:m:r:f:c:e:z:s:t:d:o:u:v:x:y:")) != -1) {
+        switch (opt) {
+        case 'l': {
+            FILE *fp = fopen(optarg, "r");
+            if (fp == NULL) {
+                fprintf(stderr, "cannot read %s\n", optarg);
+                return 1;
+            }
+            char line[1024];
+            while (fgets(line, sizeof(line), fp)) {
+                line[strcspn(line, "\r\n")] = 0;
+                if (line[0] != 0 && line[0] != '#') dirs.push_back(line);
+            }
+            fclose(fp);
+            break;
+        }
+        case 'j': options.workers = atoi(optarg); break;
+        case 'p': options.mesh_threads = atoi(optarg); break;
+        case 'm': options.memory_budget = (size_t)atol(optarg) * 1024 * 1024; break;
+        case 'r': options.report = optarg; break;
+        case 't': options.trace = optarg; break;
+        case 's': options.stream = optarg; break;
+        case 'c':
+            if (strcmp(optarg, "footprint") == 0) {
+                options.carve_mode = CARVE_FOOTPRINT;
+            } else if (strcmp(optarg, "center") == 0) {
+                options.carve_mode = CARVE_CENTER;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "nets") == 0) {
+                options.mesh_method = MESH_SURFACE_NETS;
+            } else if (strcmp(optarg, "cubes") == 0) {
+                options.mesh_method = MESH_MARCHING_CUBES;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'z': {
+            float value = 0, error = 1;
+            if (sscanf(optarg, "cluster:%f", &value) == 1 && value > 0) {
+                options.decimate_mode = DECIMATE_CLUSTER;
+                options.decimate_ratio = 1;
+                options.decimate_error = value;
+            } else if (sscanf(optarg, "quadric:%f:%f", &value, &error) >= 1 && value > 0 && value <= 1) {
+                options.decimate_mode = DECIMATE_QUADRIC;
+                options.decimate_ratio = value;
+                options.decimate_error = error;
+            } else {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        }
+        case 'f':
+            options.xyz = strstr(optarg, "xyz") != NULL;
+            options.stl = strstr(optarg, "stl") != NULL;
+            options.ply = strstr(optarg, "ply") != NULL;
+            options.obj = strstr(optarg, "obj") != NULL;
+            options.metrics = strstr(optarg, "metrics") != NULL;
+            break;
+        case 'd': options.camera.distance = atof(optarg); break;
+        case 'o': options.camera.offset = atof(optarg); break;
+        case 'u': options.camera.center_u = atof(optarg); break;
+        case 'v': options.camera.center_v = atof(optarg); break;
+        case 'x': options.camera.fx = atof(optarg); break;
+        case 'y': options.camera.fy = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    for (int i = optind; i < argc; i++) dirs.push_back(argv[i]);
+    if (dirs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.workers < 1) options.workers = 1;
+
+    for (size_t i = 0; i < dirs.size(); i++) {
+        Scan *scan = new Scan();
+        scan->dir = dirs[i];
+        scan->point_cloud = NULL;
+        scan->carving = false;
+        scan->failed = false;
+        scan->start_ms = scan->end_ms = 0;
+        scan->voxels = 0;
+        if (!list_frames(scan->dir, scan->frames)) {
+            fprintf(stderr, "%s: no img_N.jpg frames, skipped\n", scan->dir.c_str());
+            delete scan;
+            continue;
+        }
+        if (!load_angles(*scan)) {
+            delete scan;
+            continue;
+        }
+        scan->silhouettes.resize(scan->frames.size());
+        scan->cameras.resize(scan->frames.size());
+        scans.push_back(scan);
+
+        size_t first = jobs.size();
+        add_scan_jobs((int)scans.size() - 1);
+        scan->jobs_left = (int)(jobs.size() - first);
+    }
+    jobs_remaining = (int)jobs.size();
+    if (options.mesh_threads < 1) options.mesh_threads = max(1, options.workers / max(1, (int)scans.size()));
+
+    printf("%d scans, %d jobs, %d workers, %d MB budget\n", (int)scans.size(), (int)jobs.size(),
+           options.workers, (int)(options.memory_budget / (1024 * 1024)));
+
+    t0 = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (int i = 0; i < options.workers; i++) workers.push_back(thread(worker_main, i));
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+
+    write_report(options.report);
+    if (!options.trace.empty()) {
+        int events = trace_save_json(options.trace.c_str());
+        printf("%d trace events saved to %s\n", events, options.trace.c_str());
+    }
+#if MEMPROF_ENABLE
+    memprof_report(stdout);
+#endif
+
+    int failed = 0;
+    for (size_t s = 0; s < scans.size(); s++) {
+        if (scans[s]->failed) failed++;
+        delete scans[s];
+    }
+    return failed ? 2 : 0;
+}
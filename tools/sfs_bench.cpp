@@ -0,0 +1,665 @@
+/*
+** Synthetic scene benchmark (host tool)
+**
+** Copyright (c) 2017 Jun Takeda
+**
+** Permission is hereby granted, free of charge, to any person obtaining
+** a copy of this software and associated documentation files (the
+** "Software"), to deal in the Software without restriction, including
+** without limitation the rights to use, copy, modify, merge, publish,
+** distribute, sublicense, and/or sell copies of the Software, and to
+** permit persons to whom the Software is furnished to do so, subject to
+** the following conditions:
+**
+** The above copyright notice and this permission notice shall be
+** included in all copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+** EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+** MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+** IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+** CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+** TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+** SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+**
+** [ MIT license: http://www.opensource.org/licenses/mit-license.php ]
+*/
+
+// Benchmarks and checks the reconstruction pipeline on analytic shapes.
+//
+// Exact silhouettes of a sphere, a cylinder, a torus and a box with holes are
+// rendered by ray marching their distance functions through the inverse of
+// projection() (the ray through the middle of each pixel's footprint). Each
+// shape is then carved (centre, footprint and deferred modes), finalized,
+// meshed and exported, and every stage reports its median time over the
+// repeats as a throughput:
+//   carve and finalize: grid voxels per second (so the carving modes compare
+//   directly), mesh: marching cubes per second (no output), export: MB written
+//   per second
+//   (including meshing; "all" writes stl, ply and obj from one pass).
+//
+// Checks against the analytic shape (a failed check makes the exit status 2):
+//   - no voxel lying deeper than one voxel inside the shape is carved
+//   - deferred carving gives the same hull as centre carving
+//   - footprint carving keeps every voxel centre carving keeps
+//   - hull volume / true volume is within the shape's bounds (the visual hull
+//     can only overshoot, by an amount that depends on the shape and views)
+//   - measure() gives the voxel count, faces, centroid and bounding box of a voxel by voxel count
+//   - mesh volume / voxel volume and mesh area / true area are plausible
+//   - the slab-parallel mesher gives the same triangles as the serial one
+//   - the surface nets mesh is closed and outward facing (volume close to the hull)
+//   - decimation keeps the volume of the marching cubes mesh with fewer triangles,
+//     (edge collapse passes the whole mesh on over its triangle limit)
+//
+// The grid size is fixed at compile time, so build one binary per size:
+//   for n in 50 100 200; do
+//     g++ -std=c++11 -O2 -pthread -I../libs -I/usr/include/opencv4 -I/usr/include/opencv4/opencv2
+//         -DPCD_SIZE=$n "-DPCD_SCALE=(100.0/$n)" sfs_bench.cpp ../libs/reconstruction.cpp
+//         ../libs/deferred_carver.cpp ../libs/tinypcl.cpp ../libs/marchingcubes.cpp
+//         ../libs/mesh_sink.cpp ../libs/mesh_stream.cpp ../libs/geometry.cpp ../libs/carve_kernel.cpp
+//         ../libs/parallel_mesher.cpp ../libs/mesh_decimator.cpp ../libs/trace.cpp ../libs/mem_profile.cpp
+//         -lopencv_core -lopencv_imgproc -o sfs_bench_$n
+//   done
+// -DGEOMETRY_SCALAR=1 (float) or 2 (Q16.16) selects the geometry scalar type, and
+// -DGEOMETRY_VALIDATE=1 adds the error against the double reference to the checks.
+// With float, centre carving uses the vector kernel (-mavx for AVX, -DCARVE_SIMD=0
+// for the scalar fallback); deferred carving stays per voxel, so deferred_mismatch
+// compares the two. Deferred carving also uses the cropped silhouettes of grid_roi().
+// -DMEMPROF_ENABLE=1 prints the heap use of each stage over all runs at the end.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "reconstruction.hpp"
+#include "deferred_carver.hpp"
+#include "carve_kernel.hpp"
+#include "tinypcl.hpp"
+#include "parallel_mesher.hpp"
+#include "mesh_decimator.hpp"
+#include "mem_profile.hpp"
+
+using namespace std;
+
+// Camera parameters (same as main.cpp)
+#define CAMERA_DISTANCE 115
+#define CAMERA_OFFSET   0
+#define CAMERA_CENTER_U 320
+#define CAMERA_CENTER_V 240
+#define CAMERA_FX       370.0
+#define CAMERA_FY       370.0
+#define IMAGE_WIDTH     640
+#define IMAGE_HEIGHT    480
+
+#define PI 3.14159265358979
+
+struct Shape {
+    string name;
+    function<double(double, double, double)> sdf;   // signed distance (mm), negative inside
+    double bound;                                   // radius of a sphere around the shape
+    double volume, area;                            // ground truth
+    double max_volume_ratio;                        // acceptable visual hull overshoot
+};
+
+struct Options {
+    vector<string> shapes;
+    vector<int> views;
+    int repeats;
+    string dir;
+    string report;
+};
+
+static Options options;
+static CameraModel camera;
+static FILE *report = NULL;
+static int failures = 0;
+
+static double length2(double a, double b) { return sqrt(a * a + b * b); }
+static double length3(double a, double b, double c) { return sqrt(a * a + b * b + c * c); }
+
+// Shapes sized to the grid extent e (mm)
+static vector<Shape> make_shapes(double e) {
+    vector<Shape> shapes;
+
+    double r = 0.3 * e;
+    shapes.push_back(Shape{ "sphere",
+        [=](double x, double y, double z) { return length3(x, y, z) - r; },
+        r, 4.0 / 3.0 * PI * r * r * r, 4 * PI * r * r, 1.10 });
+
+    // Upright cylinder (radius cr, height ch)
+    double cr = 0.25 * e, ch = 0.6 * e;
+    shapes.push_back(Shape{ "cylinder",
+        [=](double x, double y, double z) {
+            double dr = length2(x, y) - cr, dz = fabs(z) - ch / 2;
+            return min(max(dr, dz), 0.0) + length2(max(dr, 0.0), max(dz, 0.0));
+        },
+        length2(cr, ch / 2), PI * cr * cr * ch, 2 * PI * cr * ch + 2 * PI * cr * cr, 1.10 });
+
+    // Standing torus (axis along X), so the turntable views see through the hole
+    double tR = 0.25 * e, tr = 0.1 * e;
+    shapes.push_back(Shape{ "torus",
+        [=](double x, double y, double z) { return length2(length2(y, z) - tR, x) - tr; },
+        tR + tr, 2 * PI * PI * tR * tr * tr, 4 * PI * PI * tR * tr, 1.60 });
+
+    // Box (bx x by x bz) with two holes of radius hr along X; the holes are only
+    // carved by views close to the X axis, so few views leave them filled
+    double bx = 0.6 * e, by = 0.5 * e, bz = 0.4 * e, hr = 0.08 * e, hy = 0.12 * e;
+    shapes.push_back(Shape{ "box_holes",
+        [=](double x, double y, double z) {
+            double dx = fabs(x) - bx / 2, dy = fabs(y) - by / 2, dz = fabs(z) - bz / 2;
+            double box = min(max(dx, max(dy, dz)), 0.0) + length3(max(dx, 0.0), max(dy, 0.0), max(dz, 0.0));
+            double hole = min(length2(y - hy, z), length2(y + hy, z)) - hr;
+            return max(box, -hole);
+        },
+        length3(bx / 2, by / 2, bz / 2),
+        bx * by * bz - 2 * PI * hr * hr * bx,
+        2 * (bx * by + by * bz + bz * bx) - 4 * PI * hr * hr + 4 * PI * hr * bx, 1.60 });
+
+    return shapes;
+}
+
+// Middle of the range of t where (int)t == k
+static double trunc_center(int k) {
+    return (k > 0) ? k + 0.5 : (k < 0) ? k - 0.5 : 0.0;
+}
+
+// Renders the silhouette seen at the turntable angle rad
+static void render(const Shape &shape, double rad, cv::Mat &img_silhouette) {
+    img_silhouette = cv::Mat(camera.height, camera.width, CV_8U);
+    double c = cos(rad), s = sin(rad);
+
+    // Camera position in world coordinates (rotated frame: (0, distance, -offset))
+    double ox = -s * camera.distance, oy = c * camera.distance, oz = -camera.offset;
+
+    for (int v = 0; v < camera.height; v++) {
+        unsigned char *row = img_silhouette.ptr<unsigned char>(v);
+        double sv = trunc_center(v - camera.height + (int)camera.center_v);
+
+        for (int u = 0; u < camera.width; u++) {
+            double tu = trunc_center((int)camera.center_u - u);
+
+            // Ray direction in the rotated frame, then in world coordinates
+            double xc = -tu / camera.fx, yc = -1, zc = -sv / camera.fy;
+            double dx = c * xc - s * yc, dy = s * xc + c * yc, dz = zc;
+            double norm = length3(dx, dy, dz);
+            dx /= norm; dy /= norm; dz /= norm;
+
+            // Enter and leave the bounding sphere
+            double b = ox * dx + oy * dy + oz * dz;
+            double q = ox * ox + oy * oy + oz * oz - shape.bound * shape.bound * 1.01;
+            double disc = b * b - q;
+            row[u] = 0;
+            if (disc < 0) continue;
+
+            double t = -b - sqrt(disc), t_exit = -b + sqrt(disc);
+            while (t < t_exit) {
+                double d = shape.sdf(ox + t * dx, oy + t * dy, oz + t * dz);
+                if (d < 1e-4) {
+                    row[u] = 255;
+                    break;
+                }
+                t += d;
+            }
+        }
+    }
+}
+
+static double now_ms() {
+    return chrono::duration<double, milli>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Median time (ms) of repeats runs of run(), prepare() is not timed
+static double time_median(function<void()> prepare, function<void()> run) {
+    vector<double> times;
+    for (int i = 0; i < options.repeats; i++) {
+        prepare();
+        double t = now_ms();
+        run();
+        times.push_back(now_ms() - t);
+    }
+    sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+static long file_size(const string &path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return -1;
+    return (long)st.st_size;
+}
+
+static long long count_voxels(const PointCloud &point_cloud) {
+    long long n = 0;
+    for (int z = 0; z < PointCloud::SIZE; z++) {
+        for (int y = 0; y < PointCloud::SIZE; y++) {
+            for (int x = 0; x < PointCloud::SIZE; x++) n += point_cloud.get(x, y, z);
+        }
+    }
+    return n;
+}
+
+// Measures the points voxel by voxel with get(), as a reference for measure()
+static void measure_voxels(const PointCloud &point_cloud, PCD_METRICS &metrics) {
+    const int n = PointCloud::SIZE;
+    double sum[3] = { 0, 0, 0 };
+    int mins[3] = { n, n, n }, maxs[3] = { -1, -1, -1 };
+    metrics.voxels = metrics.faces = 0;
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                if (!point_cloud.get(x, y, z)) continue;
+                int p[3] = { x, y, z };
+                for (int j = 0; j < 3; j++) {
+                    sum[j] += p[j];
+                    mins[j] = min(mins[j], p[j]);
+                    maxs[j] = max(maxs[j], p[j]);
+                    for (int d = -1; d <= 1; d += 2) {
+                        int q[3] = { x, y, z };
+                        q[j] += d;
+                        if (q[j] < 0 || q[j] >= n || !point_cloud.get(q[0], q[1], q[2])) metrics.faces++;
+                    }
+                }
+                metrics.voxels++;
+            }
+        }
+    }
+    for (int j = 0; j < 3; j++) {
+        metrics.centroid[j] = metrics.voxels ? sum[j] / metrics.voxels * PointCloud::SCALE : 0;
+        metrics.min[j] = metrics.voxels ? (mins[j] - 0.5) * PointCloud::SCALE : 0;
+        metrics.max[j] = metrics.voxels ? (maxs[j] + 0.5) * PointCloud::SCALE : 0;
+    }
+}
+
+static void report_stage(const Shape &shape, int views, const char *stage, double ms, double amount, const char *unit) {
+    double rate = amount / (ms / 1000.0);
+    printf("  %-18s %9.2f ms %10.2f %s\n", stage, ms, rate, unit);
+    if (report) {
+        fprintf(report, "%d,%s,%d,%s,%.3f,%.3f,%s\n", PointCloud::SIZE, shape.name.c_str(), views, stage, ms, rate, unit);
+    }
+}
+
+static void report_check(const Shape &shape, int views, const char *check, double value, bool ok) {
+    printf("  %-18s %12.4f  %s\n", check, value, ok ? "ok" : "FAIL");
+    if (!ok) failures++;
+    if (report) {
+        fprintf(report, "%d,%s,%d,%s,,%.4f,%s\n", PointCloud::SIZE, shape.name.c_str(), views, check, value, ok ? "ok" : "FAIL");
+    }
+}
+
+// Renders the views once (views of different counts at the same angle are shared)
+static map<double, cv::Mat> silhouettes;
+
+static const cv::Mat& silhouette(const Shape &shape, int view, int views) {
+    double key = (double)view / views;
+    map<double, cv::Mat>::iterator it = silhouettes.find(key);
+    if (it == silhouettes.end()) {
+        render(shape, view_angle(view, views), silhouettes[key]);
+        it = silhouettes.find(key);
+    }
+    return it->second;
+}
+
+static void run_shape(const Shape &shape, int views) {
+    printf("%s, %d views, grid %d^3 (%.3f mm), %s%s%s\n", shape.name.c_str(), views, PointCloud::SIZE, PointCloud::SCALE, GEOMETRY_NAME,
+        CARVE_KERNEL_ENABLE ? ", kernel " : "", CARVE_KERNEL_ENABLE ? carve_simd_name() : "");
+    const long long grid = (long long)PointCloud::SIZE * PointCloud::SIZE * PointCloud::SIZE;
+    const double voxel_volume = pow((double)PointCloud::SCALE, 3);
+
+    vector<const cv::Mat*> imgs;
+    vector<cv::Mat> sats(views);
+    for (int i = 0; i < views; i++) {
+        imgs.push_back(&silhouette(shape, i, views));
+        silhouette_sat(*imgs[i], sats[i]);
+    }
+
+    // Carving, the three modes
+    static PointCloud center, footprint, deferred, work;
+    double ms = time_median([&]() { center.clear(); }, [&]() {
+        for (int i = 0; i < views; i++) shape_from_silhouette(center, *imgs[i], camera, view_angle(i, views));
+    });
+    report_stage(shape, views, "carve_center", ms, grid / 1e6, "Mvoxel/s");
+
+    ms = time_median([&]() { footprint.clear(); }, [&]() {
+        for (int i = 0; i < views; i++) shape_from_silhouette_sat(footprint, sats[i], camera, view_angle(i, views));
+    });
+    report_stage(shape, views, "carve_footprint", ms, grid / 1e6, "Mvoxel/s");
+
+    // Deferred carving stores the region of interest of each view only (like main.cpp)
+    vector<cv::Rect> rois;
+    cv::Size max_roi(0, 0);
+    for (int i = 0; i < views; i++) {
+        rois.push_back(grid_roi(camera, view_angle(i, views)));
+        max_roi.width = max(max_roi.width, rois[i].width);
+        max_roi.height = max(max_roi.height, rois[i].height);
+    }
+    DeferredCarver carver(camera, views, max_roi);
+    ms = time_median([&]() { deferred.clear(); carver.clear(); }, [&]() {
+        for (int i = 0; i < views; i++) carver.add_view((*imgs[i])(rois[i]), view_angle(i, views), rois[i]);
+        carver.carve(deferred);
+    });
+    report_stage(shape, views, "carve_deferred", ms, grid / 1e6, "Mvoxel/s");
+
+    // Checks on the hull (world coordinates, before finalize)
+    long long carved_inside = 0, deferred_mismatch = 0, footprint_lost = 0;
+    for (int z = 0; z < PointCloud::SIZE; z++) {
+        for (int y = 0; y < PointCloud::SIZE; y++) {
+            for (int x = 0; x < PointCloud::SIZE; x++) {
+                double xx = (x + (-PointCloud::SIZE / 2)) * PointCloud::SCALE;
+                double yy = (y + (-PointCloud::SIZE / 2)) * PointCloud::SCALE;
+                double zz = (z + (-PointCloud::SIZE / 2)) * PointCloud::SCALE;
+                if (!center.get(x, y, z) && shape.sdf(xx, yy, zz) < -PointCloud::SCALE) carved_inside++;
+                if (center.get(x, y, z) != deferred.get(x, y, z)) deferred_mismatch++;
+                if (center.get(x, y, z) && !footprint.get(x, y, z)) footprint_lost++;
+            }
+        }
+    }
+    long long voxels = count_voxels(center);
+    report_check(shape, views, "carved_inside", carved_inside, carved_inside == 0);
+    report_check(shape, views, "deferred_mismatch", deferred_mismatch, deferred_mismatch == 0);
+    report_check(shape, views, "footprint_lost", footprint_lost, footprint_lost == 0);
+    double volume_ratio = voxels * voxel_volume / shape.volume;
+    report_check(shape, views, "volume_ratio", volume_ratio, volume_ratio > 0.97 && volume_ratio < shape.max_volume_ratio);
+
+    // The layout conversions and the neighbourhood/brick accessors agree with get()
+    static uint32_t linear[PCD_LINEAR_WORDS];
+    center.to_linear(linear);
+    work.clear();
+    work.from_linear(linear);
+    long long layout_mismatch = 0;
+    for (int z = 0; z < PointCloud::SIZE; z++) {
+        for (int y = 0; y < PointCloud::SIZE; y++) {
+            for (int x = 0; x < PointCloud::SIZE; x++) {
+                int index = PCD_INDEX(x, y, z);
+                unsigned int value = center.get(x, y, z);
+                if (((linear[index >> 5] >> (index & 31)) & 1) != value || work.get(x, y, z) != value) layout_mismatch++;
+
+                uint32_t brick[2];
+                center.get_brick(x / 4, y / 4, z / 4, brick);
+                if (((brick[(z >> 1) & 1] >> (PCD_BRICK_BIT(x, y, z) & 31)) & 1) != value) layout_mismatch++;
+
+                if (x == 0 || y == 0 || z == 0 || x == PointCloud::SIZE - 1 || y == PointCloud::SIZE - 1 || z == PointCloud::SIZE - 1) continue;
+                uint32_t around = center.neighbourhood(x, y, z);
+                unsigned int corners = center.cube(x, y, z);
+                for (int i = 0; i < 27; i++) {
+                    if (((around >> i) & 1) != center.get(x + i % 3 - 1, y + (i / 3) % 3 - 1, z + i / 9 - 1)) layout_mismatch++;
+                }
+                static const int cube_corners[8][3] = {
+                    {0,0,0}, {1,0,0}, {1,1,0}, {0,1,0}, {0,0,1}, {1,0,1}, {1,1,1}, {0,1,1}
+                };
+                for (int i = 0; i < 8; i++) {
+                    if (((corners >> i) & 1) != center.get(x + cube_corners[i][0], y + cube_corners[i][1], z + cube_corners[i][2])) layout_mismatch++;
+                }
+            }
+        }
+    }
+    report_check(shape, views, "layout_mismatch", layout_mismatch, layout_mismatch == 0);
+
+    // Memory of the carved grid (depends on the hull with PCD_LAYOUT_RUNS)
+    double storage_kb = center.storage_bytes() / 1024.0;
+    printf("  %-18s %12.1f KB\n", "storage", storage_kb);
+    if (report) {
+        fprintf(report, "%d,%s,%d,storage,,%.1f,KB\n", PointCloud::SIZE, shape.name.c_str(), views, storage_kb);
+    }
+
+    // Finalize
+    ms = time_median([&]() { work = center; }, [&]() { work.finalize(); });
+    report_stage(shape, views, "finalize", ms, grid / 1e6, "Mvoxel/s");
+    center.finalize();
+
+    // Measurements from popcounts, against the voxel by voxel reference
+    PCD_METRICS metrics, reference;
+    ms = time_median([]() {}, [&]() { center.measure(metrics); });
+    report_stage(shape, views, "measure", ms, grid / 1e6, "Mvoxel/s");
+    measure_voxels(center, reference);
+    long long measure_mismatch = (metrics.voxels != reference.voxels) + (metrics.faces != reference.faces);
+    for (int j = 0; j < 3; j++) {
+        measure_mismatch += fabs(metrics.centroid[j] - reference.centroid[j]) > 1e-6;
+        measure_mismatch += metrics.min[j] != reference.min[j] || metrics.max[j] != reference.max[j];
+    }
+    report_check(shape, views, "measure_mismatch", (double)measure_mismatch, measure_mismatch == 0);
+
+    // Meshing without output
+    const double cubes = pow((double)(PointCloud::SIZE - 1), 3);
+    StatsSink stats;
+    ms = time_median([]() {}, [&]() {
+        MeshSink *sinks[] = { &stats };
+        center.generate_mesh(sinks, 1);
+    });
+    report_stage(shape, views, "mesh", ms, cubes / 1e6, "Mcube/s");
+
+    // Slab-parallel meshing on every core, same triangles in the same order
+    const int threads = max(1, (int)thread::hardware_concurrency());
+    ms = time_median([]() {}, [&]() {
+        MeshSink *sinks[] = { &stats };
+        generate_mesh_parallel(center, sinks, 1, threads);
+    });
+    report_stage(shape, views, "mesh_parallel", ms, cubes / 1e6, "Mcube/s");
+    long long parallel_mismatch = 0;
+    for (int method = MESH_MARCHING_CUBES; method <= MESH_SURFACE_NETS; method++) {
+        MemorySink serial((size_t)-1), parallel((size_t)-1);
+        MeshSink *serial_sinks[] = { &serial };
+        MeshSink *parallel_sinks[] = { &parallel };
+        center.generate_mesh(serial_sinks, 1, method);
+        generate_mesh_parallel(center, parallel_sinks, 1, threads, method);
+        if (serial.triangles.size() != parallel.triangles.size()) {
+            parallel_mismatch++;
+        } else if (!serial.triangles.empty()) {
+            parallel_mismatch += memcmp(serial.triangles.data(), parallel.triangles.data(), serial.triangles.size() * sizeof(TRIANGLE)) != 0;
+            parallel_mismatch += memcmp(serial.normals.data(), parallel.normals.data(), serial.normals.size() * sizeof(XYZ)) != 0;
+        }
+    }
+    report_check(shape, views, "parallel_mismatch", (double)parallel_mismatch, parallel_mismatch == 0);
+
+    // Marching cubes on a binary grid cuts the corners, losing up to about
+    // one voxel layer of the surface
+    double hull_volume = count_voxels(center) * voxel_volume;
+    double mesh_volume_ratio = fabs(stats.volume) / hull_volume;
+    double min_mesh_ratio = 1.0 - stats.area * PointCloud::SCALE / hull_volume;
+    report_check(shape, views, "mesh_volume_ratio", mesh_volume_ratio, mesh_volume_ratio > min_mesh_ratio && mesh_volume_ratio < 1.05);
+    // (the box loses the surface of its holes when no view looks through them)
+    double area_ratio = stats.area / shape.area;
+    report_check(shape, views, "area_ratio", area_ratio, area_ratio > 0.7 && area_ratio < 1.6);
+
+    // Surface nets: the vertices sit between the points and the empty voxels, so the
+    // mesh follows the voxel faces (positive volume: faces oriented outwards)
+    StatsSink nets;
+    ms = time_median([]() {}, [&]() {
+        MeshSink *sinks[] = { &nets };
+        center.generate_mesh(sinks, 1, MESH_SURFACE_NETS);
+    });
+    report_stage(shape, views, "mesh_nets", ms, cubes / 1e6, "Mcube/s");
+    double nets_volume_ratio = nets.volume / hull_volume;
+    report_check(shape, views, "nets_volume_ratio", nets_volume_ratio, nets_volume_ratio > min_mesh_ratio && nets_volume_ratio < 1.02);
+    double nets_area_ratio = nets.area / shape.area;
+    report_check(shape, views, "nets_area_ratio", nets_area_ratio, nets_area_ratio > 0.7 && nets_area_ratio < 1.6);
+    double nets_triangle_ratio = (double)nets.triangles / stats.triangles;
+    report_check(shape, views, "nets_triangle_ratio", nets_triangle_ratio, nets_triangle_ratio < 2.5);
+
+    // Decimation of the marching cubes mesh: clustering on two voxel cells, and edge
+    // collapse to a quarter of the triangles without moving the surface by more than a voxel
+    const char *decimate_names[] = { "cluster", "quadric" };
+    for (int mode = DECIMATE_CLUSTER; mode <= DECIMATE_QUADRIC; mode++) {
+        StatsSink decimated;
+        float error = (float)(mode == DECIMATE_CLUSTER ? 2 * PointCloud::SCALE : PointCloud::SCALE);
+        ms = time_median([]() {}, [&]() {
+            MeshSink *sinks[] = { &decimated };
+            DecimateSink decimate(sinks, 1, mode, 0.25f, error, (size_t)-1);
+            MeshSink *decimate_sinks[] = { &decimate };
+            center.generate_mesh(decimate_sinks, 1);
+        });
+        string name = string("decimate_") + decimate_names[mode];
+        report_stage(shape, views, name.c_str(), ms, stats.triangles / 1e6, "Mtri/s");
+        double volume_ratio = fabs(decimated.volume) / fabs(stats.volume);
+        report_check(shape, views, (name + "_volume_ratio").c_str(), volume_ratio, volume_ratio > 0.98 && volume_ratio < 1.02);
+        double triangle_ratio = (double)decimated.triangles / stats.triangles;
+        report_check(shape, views, (name + "_triangle_ratio").c_str(), triangle_ratio, triangle_ratio < 0.6);
+
+        // Clustering ignores the triangle limit, edge collapse passes the whole mesh on over it
+        StatsSink capped;
+        MeshSink *capped_sinks[] = { &capped };
+        DecimateSink capped_decimate(capped_sinks, 1, mode, 0.25f, error, stats.triangles / 2);
+        MeshSink *decimate_sinks[] = { &capped_decimate };
+        center.generate_mesh(decimate_sinks, 1);
+        double capped_ratio = (double)capped.triangles / stats.triangles;
+        bool capped_ok = (mode == DECIMATE_CLUSTER) ?
+            !capped_decimate.passed_through() && capped.triangles == decimated.triangles :
+            capped_decimate.passed_through() && capped.triangles == stats.triangles;
+        report_check(shape, views, (name + "_capped_ratio").c_str(), capped_ratio, capped_ok);
+    }
+
+#if GEOMETRY_VALIDATE
+    // Error of the geometry scalar type against double (one carving and meshing pass)
+    geometry_error_clear();
+    work.clear();
+    for (int i = 0; i < views; i++) shape_from_silhouette(work, *imgs[i], camera, view_angle(i, views));
+    center.generate_mesh(NULL, 0);
+    // Points projecting within the rounding error of a pixel border may land on
+    // either side, the hull checks above tell whether that matters
+    double pixel_mismatch = (double)geometry_error.pixel_mismatches / geometry_error.projections;
+    report_check(shape, views, "pixel_mismatch", pixel_mismatch, pixel_mismatch < 0.05);
+    report_check(shape, views, "cell_mismatch", geometry_error.cell_mismatches, geometry_error.cell_mismatches == 0);
+    report_check(shape, views, "vertex_error", geometry_error.max_vertex_error, geometry_error.max_vertex_error < 0.001);
+    report_check(shape, views, "normal_error", geometry_error.max_normal_error, geometry_error.max_normal_error < 0.001);
+#endif
+
+    // Exports
+    char base[256];
+    snprintf(base, sizeof(base), "%s/bench_%s_%d.", options.dir.c_str(), shape.name.c_str(), views);
+    const char *formats[] = { "stl", "ply", "obj" };
+    for (int f = 0; f < 3; f++) {
+        string path = string(base) + formats[f];
+        ms = time_median([]() {}, [&]() {
+            MeshSink *sink;
+            if (f == 0) sink = new StlSink(path.c_str());
+            else if (f == 1) sink = new PlySink(path.c_str());
+            else sink = new ObjSink(path.c_str());
+            center.generate_mesh(&sink, 1);
+            delete sink;
+        });
+        string stage = string("export_") + formats[f];
+        report_stage(shape, views, stage.c_str(), ms, file_size(path) / 1e6, "MB/s");
+    }
+
+    long all_bytes = 0;
+    ms = time_median([]() {}, [&]() {
+        StlSink stl((string(base) + "stl").c_str());
+        PlySink ply((string(base) + "ply").c_str());
+        ObjSink obj((string(base) + "obj").c_str());
+        MeshSink *sinks[] = { &stl, &ply, &obj };
+        center.generate_mesh(sinks, 3);
+    });
+    for (int f = 0; f < 3; f++) all_bytes += file_size(string(base) + formats[f]);
+    report_stage(shape, views, "export_all", ms, all_bytes / 1e6, "MB/s");
+
+    string nets_stl = string(base) + "nets.stl";
+    ms = time_median([]() {}, [&]() {
+        StlSink stl(nets_stl.c_str());
+        MeshSink *sinks[] = { &stl };
+        center.generate_mesh(sinks, 1, MESH_SURFACE_NETS);
+    });
+    report_stage(shape, views, "export_stl_nets", ms, file_size(nets_stl) / 1e6, "MB/s");
+
+    string xyz = string(base) + "xyz";
+    ms = time_median([]() {}, [&]() { center.save_as_xyz(xyz.c_str()); });
+    report_stage(shape, views, "export_xyz", ms, file_size(xyz) / 1e6, "MB/s");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -s shapes  comma separated sphere,cylinder,torus,box_holes (default: all)\n"
+        "  -v views   comma separated view counts (default: 10,20,40)\n"
+        "  -n count   repeats per stage, the median is reported (default: 3)\n"
+        "  -o dir     directory for the exported files (default: /tmp)\n"
+        "  -r file    also write the results as CSV\n"
+        "  -d mm      camera distance (default: %d)\n",
+        prog, CAMERA_DISTANCE);
+}
+
+static vector<string> split(const char *list) {
+    vector<string> items;
+    string s(list);
+    size_t start = 0;
+    while (start <= s.size()) {
+        size_t end = s.find(',', start);
+        if (end == string::npos) end = s.size();
+        if (end > start) items.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+int main(int argc, char *argv[]) {
+    CameraModel cam = {
+        CAMERA_DISTANCE, CAMERA_OFFSET,
+        CAMERA_CENTER_U, CAMERA_CENTER_V, CAMERA_FX, CAMERA_FY,
+        IMAGE_WIDTH, IMAGE_HEIGHT
+    };
+    camera = cam;
+    options.views.push_back(10);
+    options.views.push_back(20);
+    options.views.push_back(40);
+    options.repeats = 3;
+    options.dir = "/tmp";
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:v:n:o:r:d:")) != -1) {
+        switch (opt) {
+        case 's': options.shapes = split(optarg); break;
+        case 'v': {
+            options.views.clear();
+            vector<string> items = split(optarg);
+            for (size_t i = 0; i < items.size(); i++) options.views.push_back(atoi(items[i].c_str()));
+            break;
+        }
+        case 'n': options.repeats = max(1, atoi(optarg)); break;
+        case 'o': options.dir = optarg; break;
+        case 'r': options.report = optarg; break;
+        case 'd': camera.distance = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!options.report.empty()) {
+        report = fopen(options.report.c_str(), "w");
+        if (report == NULL) {
+            fprintf(stderr, "cannot write %s\n", options.report.c_str());
+            return 1;
+        }
+        fprintf(report, "grid,shape,views,stage,time_ms,value,unit\n");
+    }
+
+    vector<Shape> shapes = make_shapes(PointCloud::SIZE * PointCloud::SCALE);
+    int runs = 0;
+    for (size_t i = 0; i < shapes.size(); i++) {
+        if (!options.shapes.empty() && find(options.shapes.begin(), options.shapes.end(), shapes[i].name) == options.shapes.end()) continue;
+
+        silhouettes.clear();
+        for (size_t v = 0; v < options.views.size(); v++) {
+            if (options.views[v] < 1) continue;
+            run_shape(shapes[i], options.views[v]);
+            runs++;
+        }
+    }
+    if (report) fclose(report);
+
+    if (runs == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    printf("%d runs, %d failed checks\n", runs, failures);
+#if MEMPROF_ENABLE
+    memprof_report(stdout);
+#endif
+    return failures ? 2 : 0;
+}